@@ -25,7 +25,20 @@
 #include <stdint.h>
 
 #define CH_EP0_TRANSFER_SIZE		0x400
+
+/* defective sensor pixels that are interpolated on the device */
+#define CH_HOT_PIXELS_MAX		32
+
+/* breakpoints of the piecewise linear sensor response correction */
+#define CH_LINEARITY_POINTS		33
+
+/* the most peaks, and the widest neighbourhood, for GET_SPECTRAL_PEAKS */
+#define CH_SPECTRAL_PEAKS_MAX		8
+#define CH_SPECTRAL_PEAK_WIDTH_MAX	8
+
 #define CH_USB_INTERFACE		0x00
+#define CH_USB_STREAM_ENDPOINT		0x81
+#define CH_USB_SRAM_OUT_ENDPOINT	0x01
 
 typedef enum {
 	/* dummy */
@@ -37,10 +50,28 @@ typedef enum {
 	CH_CMD_GET_SERIAL_NUMBER	= 0x0b,
 	CH_CMD_GET_PCB_ERRATA		= 0x33,
 	CH_CMD_GET_INTEGRAL_TIME	= 0x05,
+	CH_CMD_GET_BINNING		= 0x5c,
+	CH_CMD_GET_OVERSAMPLE		= 0x67,
+	CH_CMD_GET_READOUT_PROFILE	= 0x69,
+	CH_CMD_GET_READOUT_TIMES	= 0x6b,
+	CH_CMD_GET_HOT_PIXELS		= 0x6c,
+	CH_CMD_GET_LINEARITY		= 0x6e,
 	CH_CMD_GET_ADC_CALIBRATION_POS	= 0x51,
 	CH_CMD_GET_ADC_CALIBRATION_NEG	= 0x52,
 	CH_CMD_GET_CCD_CALIBRATION	= 0x53, //ish
 	CH_CMD_READ_SRAM		= 0x38,
+	CH_CMD_READ_SRAM_ENCODED	= 0x64,
+	CH_CMD_READ_SRAM_BULK		= 0x73,
+	CH_CMD_GET_SRAM_CRC		= 0x76,
+	CH_CMD_GET_SPECTRAL_STATUS	= 0x56,
+	CH_CMD_GET_SPECTRAL_FLAGS	= 0x58,
+	CH_CMD_GET_PIXEL_WINDOW		= 0x5a,
+	CH_CMD_GET_SPECTRAL_HEADER	= 0x5e,
+	CH_CMD_GET_SPECTRAL_STATS	= 0x5f,
+	CH_CMD_GET_SPECTRAL_PEAKS	= 0x71,
+	CH_CMD_GET_SPECTRAL_XYZ		= 0x77,
+	CH_CMD_GET_RESAMPLE_GRID	= 0x62,
+	CH_CMD_GET_SRAM_REGION		= 0x72,
 
 	/* write */
 	CH_CMD_SET_LEDS			= 0x0e,
@@ -48,9 +79,18 @@ typedef enum {
 	CH_CMD_SET_SERIAL_NUMBER	= 0x0c,
 	CH_CMD_SET_PCB_ERRATA		= 0x32,
 	CH_CMD_SET_INTEGRAL_TIME	= 0x06,
+	CH_CMD_SET_BINNING		= 0x5d,
+	CH_CMD_SET_OVERSAMPLE		= 0x68,
+	CH_CMD_SET_READOUT_PROFILE	= 0x6a,
+	CH_CMD_SET_HOT_PIXELS		= 0x6d,
+	CH_CMD_SET_LINEARITY		= 0x6f,
 	CH_CMD_SET_CCD_CALIBRATION	= 0x54, //ish
 	CH_CMD_WRITE_SRAM		= 0x39,
+	CH_CMD_WRITE_SRAM_BULK		= 0x7a,
 	CH_CMD_SET_CRYPTO_KEY		= 0x70,
+	CH_CMD_SET_SPECTRAL_FLAGS	= 0x59,
+	CH_CMD_SET_PIXEL_WINDOW		= 0x5b,
+	CH_CMD_SET_RESAMPLE_GRID	= 0x63,
 
 	/* read only */
 	CH_CMD_GET_ERROR		= 0x60,
@@ -60,8 +100,15 @@ typedef enum {
 	CH_CMD_CLEAR_ERROR		= 0x61,
 	CH_CMD_TAKE_READING_SPECTRAL	= 0x55,
 	CH_CMD_TAKE_READING_XYZ		= 0x23,
+	CH_CMD_START_READING_XYZ	= 0x79,
+	CH_CMD_TAKE_READING_DARK	= 0x57,
+	CH_CMD_START_STREAMING		= 0x65,
+	CH_CMD_STOP_STREAMING		= 0x66,
 	CH_CMD_LOAD_SRAM		= 0x41,
 	CH_CMD_SAVE_SRAM		= 0x42,
+	CH_CMD_FILL_SRAM		= 0x74,
+	CH_CMD_COPY_SRAM		= 0x75,
+	CH_CMD_CALCULATE_SRAM_CRC	= 0x78,
 	CH_CMD_LAST
 } ChCmd;
 
@@ -88,6 +135,109 @@ typedef enum {
 	CH_ILLUMINANT_LAST
 } ChIlluminant;
 
+/* Spectral processing: possible bitfield values */
+typedef enum {
+	CH_SPECTRAL_FLAG_NONE		= 0,
+	CH_SPECTRAL_FLAG_DARK_SUBTRACT	= 1 << 0,
+	CH_SPECTRAL_FLAG_AUTO_EXPOSURE	= 1 << 1,
+	CH_SPECTRAL_FLAG_RESAMPLE	= 1 << 2,
+	CH_SPECTRAL_FLAG_LINEARIZE	= 1 << 3,	/* header only */
+	CH_SPECTRAL_FLAG_SMOOTH_5	= 1 << 4,
+	CH_SPECTRAL_FLAG_SMOOTH_9	= 1 << 5,
+	CH_SPECTRAL_FLAG_LAST
+} ChSpectralFlags;
+
+/* READ_SRAM_ENCODED formats, in the top 3 bits of wValue, where a reply
+ * of wLength bytes is raw data that could not be encoded */
+typedef enum {
+	CH_SRAM_ENCODING_RAW,
+	CH_SRAM_ENCODING_PACKED12,
+	CH_SRAM_ENCODING_DELTA,
+	CH_SRAM_ENCODING_LAST
+} ChSramEncoding;
+
+/* fixed SRAM allocations, in the low byte of wValue for GET_SRAM_REGION */
+typedef enum {
+	CH_SRAM_REGION_SHADOW,		/* the whole SRAM */
+	CH_SRAM_REGION_SPECTRUM,
+	CH_SRAM_REGION_SPECTRUM_ALT,	/* the second slot when streaming */
+	CH_SRAM_REGION_DARK,
+	CH_SRAM_REGION_ACCUMULATOR,
+	CH_SRAM_REGION_RESAMPLE_INDEX,
+	CH_SRAM_REGION_RESAMPLED,
+	CH_SRAM_REGION_LAST
+} ChSramRegionId;
+
+/* SRAM region: possible bitfield values */
+typedef enum {
+	CH_SRAM_REGION_FLAG_NONE	= 0,
+	CH_SRAM_REGION_FLAG_FLASH	= 1 << 0,	/* kept by SAVE_SRAM */
+	CH_SRAM_REGION_FLAG_SHARED	= 1 << 1,	/* may be overwritten */
+	CH_SRAM_REGION_FLAG_LIVE	= 1 << 2,	/* contents in use */
+	CH_SRAM_REGION_FLAG_LAST
+} ChSramRegionFlags;
+
+/* where a region lives in the SRAM, all values are little endian */
+typedef struct {
+	uint16_t	 offset;		/* bytes */
+	uint16_t	 size;			/* bytes */
+	uint8_t		 flags;			/* ChSramRegionFlags */
+	uint8_t		 reserved;
+} ChSramRegion;
+
+/* trades ADC accuracy for readout speed */
+typedef enum {
+	CH_READOUT_PROFILE_ACCURATE,
+	CH_READOUT_PROFILE_BALANCED,
+	CH_READOUT_PROFILE_FAST,
+	CH_READOUT_PROFILE_LAST
+} ChReadoutProfile;
+
+/* spectral acquisition state */
+typedef enum {
+	CH_SPECTRAL_STATE_IDLE,
+	CH_SPECTRAL_STATE_INTEGRATING,
+	CH_SPECTRAL_STATE_LAST
+} ChSpectralState;
+
+/* describes the last spectrum taken, all values are little endian */
+typedef struct {
+	uint16_t	 integration_time;	/* ms */
+	uint16_t	 frames;
+	uint16_t	 pixel_start;
+	uint16_t	 pixel_length;
+	uint16_t	 pixel_count;		/* values stored in the SRAM */
+	uint8_t		 binning;
+	uint8_t		 flags;			/* ChSpectralFlags */
+	uint8_t		 oversample;		/* ADC conversions per pixel */
+	uint8_t		 adc_bits;		/* effective resolution */
+	uint16_t	 readout_time;		/* 100us, for the last frame */
+} ChSpectralHeader;
+
+/* sent before each frame on the bulk IN endpoint when streaming */
+typedef struct {
+	uint16_t	 sequence;		/* gaps are dropped frames */
+	uint16_t	 count;			/* uint16_t values that follow */
+	uint32_t	 timestamp;		/* ms */
+	ChSpectralHeader header;
+} ChSpectralStreamHeader;
+
+/* unbinned pixel statistics for the last frame read out */
+typedef struct {
+	uint16_t	 min;
+	uint16_t	 max;
+	uint16_t	 argmax;		/* pixel index */
+	uint16_t	 saturated;		/* number of pixels */
+	uint32_t	 sum;
+} ChSpectralStats;
+
+/* a local maximum of the stored spectrum */
+typedef struct {
+	int32_t		 wavelength;		/* nm, Q16.16 */
+	uint16_t	 position;		/* pixel, Q10.6 */
+	uint16_t	 value;
+} ChSpectralPeak;
+
 /* fatal error morse code */
 typedef enum {
 	CH_ERROR_NONE,
@@ -126,6 +276,7 @@ typedef enum {
 	CH_ERROR_I2C_SLAVE_ADDRESS,
 	CH_ERROR_I2C_SLAVE_CONFIG,
 	CH_ERROR_SELF_TEST_EEPROM,	/* since 1.2.9 */
+	CH_ERROR_DEVICE_BUSY,
 	/*< private >*/
 	CH_ERROR_LAST
 } ChError;
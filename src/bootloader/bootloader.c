@@ -30,6 +30,7 @@
 #include "ch-config.h"
 #include "ch-errno.h"
 #include "ch-flash.h"
+#include "ch-timer.h"
 
 #pragma config XINST	= OFF		/* turn off extended instruction set */
 #pragma config STVREN	= ON		/* Stack overflow reset */
@@ -299,6 +300,9 @@ main(void)
 	/* set the LED state initially */
 	PORTE = CH_STATUS_LED_GREEN;
 
+	/* used for showing errors */
+	chug_timer_init();
+
 /* Configure interrupts, per architecture */
 #ifdef USB_USE_INTERRUPTS
 	INTCONbits.PEIE = 1;
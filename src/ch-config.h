@@ -41,7 +41,7 @@ typedef struct {
 	uint32_t	 serial_number;
 	uint16_t	 pcb_errata;
 	uint8_t		 flash_success;
-	int32_t		 wavelength_cal[4];
+	int32_t		 wavelength_cal[4];	/* nm per p^k, Q16.16 */
 	uint8_t		 padding[17];
 } CHugConfig;
 
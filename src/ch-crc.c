@@ -0,0 +1,57 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "ch-crc.h"
+
+/* the reflected 0x04c11db7 polynomial for each 4 bit value, which is 64
+ * bytes of ROM rather than the 1 KiB of a byte table */
+static const uint32_t _crc32_nibble[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+/**
+ * chug_crc32:
+ * @crc: the value returned for the previous data, or 0 to start
+ * @buf: the data
+ * @len: length of @buf in bytes
+ *
+ * Calculates the same CRC32 as zlib and gzip, so the data can be checked
+ * with crc32() on the host. The data can be split across multiple calls.
+ *
+ * Returns: the CRC32 of all the data so far
+ **/
+uint32_t
+chug_crc32(uint32_t crc, const uint8_t *buf, uint16_t len)
+{
+	uint16_t i;
+
+	crc = ~crc;
+	for (i = 0; i < len; i++) {
+		crc ^= buf[i];
+		crc = (crc >> 4) ^ _crc32_nibble[crc & 0x0f];
+		crc = (crc >> 4) ^ _crc32_nibble[crc & 0x0f];
+	}
+	return ~crc;
+}
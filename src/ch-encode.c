@@ -0,0 +1,152 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "ch-encode.h"
+
+/*
+ * Both encodings are lossless and only used when they make the data
+ * shorter, so the host knows a reply as long as the raw data is not
+ * encoded at all. The buffer is encoded in place, as the output never
+ * overtakes input that has not been read yet.
+ */
+
+/**
+ * chug_encode_packed12:
+ * @buf: little endian uint16_t values
+ * @len: length of @buf in bytes, which must be even
+ *
+ * Packs the top 12 bits of each pair of values into 3 bytes, low value
+ * first:
+ *
+ *   b0 = a[11:4], b1 = b[7:4] << 4 | a[15:12], b2 = b[15:8]
+ *
+ * An odd value at the end is written as 2 bytes, a[11:4] then a[15:12].
+ *
+ * Returns: the length of the encoded data in bytes, or @len with @buf
+ * unchanged if any value has the low 4 bits set or there is only one value
+ **/
+uint16_t
+chug_encode_packed12(uint8_t *buf, uint16_t len)
+{
+	uint16_t a;
+	uint16_t b;
+	uint16_t i;
+	uint16_t j = 0;
+
+	if (len <= 2)
+		return len;
+	for (i = 0; i < len; i += 2) {
+		if (buf[i] & 0x0f)
+			return len;
+	}
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		a = (buf[i + 0] | (uint16_t) buf[i + 1] << 8) >> 4;
+		b = (buf[i + 2] | (uint16_t) buf[i + 3] << 8) >> 4;
+		buf[j++] = a;
+		buf[j++] = (a >> 8) | (b << 4);
+		buf[j++] = b >> 4;
+	}
+	if (i < len) {
+		a = (buf[i + 0] | (uint16_t) buf[i + 1] << 8) >> 4;
+		buf[j++] = a;
+		buf[j++] = a >> 8;
+	}
+	return j;
+}
+
+/* small negative differences are small too */
+static uint16_t
+chug_encode_zigzag(int16_t delta)
+{
+	if (delta < 0)
+		return ((uint16_t) ~delta << 1) | 1;
+	return (uint16_t) delta << 1;
+}
+
+/**
+ * chug_encode_delta:
+ * @buf: little endian uint16_t values
+ * @len: length of @buf in bytes, which must be even
+ *
+ * Writes the number of low bits that are zero in every value as 1 byte,
+ * and then encodes the difference from the previous value without those
+ * bits, starting from zero. Each difference is zig-zag encoded and
+ * written as 1 byte if less than 0x80 or otherwise as 2 bytes big endian
+ * with the top bit set, which always fits when at least 2 low bits are
+ * dropped.
+ *
+ * Returns: the length of the encoded data in bytes, or @len with @buf
+ * unchanged if fewer than 2 low bits are zero or it would not be shorter
+ **/
+uint16_t
+chug_encode_delta(uint8_t *buf, uint16_t len)
+{
+	uint16_t mask = 0;
+	uint16_t next;
+	uint16_t prev = 0;
+	uint16_t val;
+	uint16_t zz;
+	uint16_t i;
+	uint16_t j = 1;
+	uint8_t shift;
+
+	/* the low bits that are zero in every value */
+	for (i = 0; i < len; i += 2)
+		mask |= buf[i + 0] | (uint16_t) buf[i + 1] << 8;
+	for (shift = 0; shift < 15; shift++) {
+		if (mask & (1u << shift))
+			break;
+	}
+	if (shift < 2)
+		return len;
+
+	/* find the encoded size first, as raw data is left alone */
+	for (i = 0; i < len; i += 2) {
+		val = (buf[i + 0] | (uint16_t) buf[i + 1] << 8) >> shift;
+		zz = chug_encode_zigzag(val - prev);
+		prev = val;
+		j += zz < 0x80 ? 1 : 2;
+	}
+	if (j >= len)
+		return len;
+
+	/* the output can be one byte past the value being encoded, so the
+	 * next value is always read first */
+	next = (buf[0] | (uint16_t) buf[1] << 8) >> shift;
+	buf[0] = shift;
+	prev = 0;
+	j = 1;
+	for (i = 0; i < len; i += 2) {
+		val = next;
+		if (i + 2 < len)
+			next = (buf[i + 2] | (uint16_t) buf[i + 3] << 8) >> shift;
+		zz = chug_encode_zigzag(val - prev);
+		prev = val;
+		if (zz < 0x80) {
+			buf[j++] = zz;
+			continue;
+		}
+		buf[j++] = 0x80 | (zz >> 8);
+		buf[j++] = zz;
+	}
+	return j;
+}
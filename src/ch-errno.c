@@ -22,13 +22,12 @@
 #include <stdint.h>
 
 #include "ch-errno.h"
+#include "ch-timer.h"
 
 static void
 _led_delay(void)
 {
-	uint32_t i = 0x0;
-	for (i = 0; i < 0xffff; i++)
-		CLRWDT();
+	chug_timer_wait_us(50000);
 }
 
 void
@@ -0,0 +1,451 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "ch-spectral.h"
+
+/* quadratic Savitzky-Golay coefficients from the centre outwards, scaled
+ * to sum to 4096 so the result is normalised with a shift */
+#define CH_SPECTRAL_SMOOTH_SHIFT	12
+static const int16_t _sg5[] = { 1990, 1404, -351 };
+static const int16_t _sg9[] = { 1046, 957, 692, 248, -372 };
+
+/*
+ * The CIE 1931 2 degree colour matching functions x, y and z, normalized so
+ * that the y values sum to 1.0 and stored as Q0.19 fixed point. This means
+ * a flat spectrum gives XYZ values that are the same as the pixel values.
+ */
+static const uint16_t _cie1931[CH_SPECTRAL_CIE_POINTS][3] = {
+	{    34,     1,   158 },	/* 380 */
+	{    55,     2,   259 },	/* 385 */
+	{   104,     3,   492 },	/* 390 */
+	{   188,     5,   888 },	/* 395 */
+	{   351,    10,  1665 },	/* 400 */
+	{   569,    16,  2703 },	/* 405 */
+	{  1067,    30,  5088 },	/* 410 */
+	{  1904,    53,  9109 },	/* 415 */
+	{  3297,    98, 15838 },	/* 420 */
+	{  5269,   179, 25490 },	/* 425 */
+	{  6965,   285, 33992 },	/* 430 */
+	{  8059,   413, 39815 },	/* 435 */
+	{  8544,   564, 42859 },	/* 440 */
+	{  8539,   731, 43731 },	/* 445 */
+	{  8248,   932, 43474 },	/* 450 */
+	{  7818,  1178, 42787 },	/* 455 */
+	{  7134,  1472, 40949 },	/* 460 */
+	{  6160,  1813, 37488 },	/* 465 */
+	{  4793,  2232, 31589 },	/* 470 */
+	{  3486,  2762, 25560 },	/* 475 */
+	{  2346,  3410, 19944 },	/* 480 */
+	{  1422,  4153, 15117 },	/* 485 */
+	{   785,  5103, 11412 },	/* 490 */
+	{   361,  6344,  8667 },	/* 495 */
+	{   120,  7924,  6673 },	/* 500 */
+	{    59,  9992,  5208 },	/* 505 */
+	{   228, 12340,  3881 },	/* 510 */
+	{   714, 14921,  2740 },	/* 515 */
+	{  1552, 17418,  1920 },	/* 520 */
+	{  2689, 19459,  1404 },	/* 525 */
+	{  4060, 21147,  1034 },	/* 530 */
+	{  5538, 22443,   732 },	/* 535 */
+	{  7124, 23404,   498 },	/* 540 */
+	{  8824, 24049,   329 },	/* 545 */
+	{ 10634, 24408,   215 },	/* 550 */
+	{ 12562, 24532,   141 },	/* 555 */
+	{ 14584, 24410,    96 },	/* 560 */
+	{ 16643, 24007,    67 },	/* 565 */
+	{ 18696, 23355,    52 },	/* 570 */
+	{ 20668, 22457,    44 },	/* 575 */
+	{ 22479, 21343,    40 },	/* 580 */
+	{ 24007, 20026,    34 },	/* 585 */
+	{ 25178, 18571,    27 },	/* 590 */
+	{ 25923, 17048,    25 },	/* 595 */
+	{ 26058, 15480,    20 },	/* 600 */
+	{ 25651, 13905,    15 },	/* 605 */
+	{ 24596, 12340,     8 },	/* 610 */
+	{ 23021, 10824,     6 },	/* 615 */
+	{ 20962,  9347,     5 },	/* 620 */
+	{ 18434,  7875,     2 },	/* 625 */
+	{ 15760,  6501,     1 },	/* 630 */
+	{ 13294,  5324,     1 },	/* 635 */
+	{ 10988,  4293,     0 },	/* 640 */
+	{  8851,  3390,     0 },	/* 645 */
+	{  6955,  2625,     0 },	/* 650 */
+	{  5365,  2002,     0 },	/* 655 */
+	{  4045,  1496,     0 },	/* 660 */
+	{  2973,  1094,     0 },	/* 665 */
+	{  2144,   785,     0 },	/* 670 */
+	{  1560,   569,     0 },	/* 675 */
+	{  1147,   417,     0 },	/* 680 */
+	{   807,   292,     0 },	/* 685 */
+	{   557,   201,     0 },	/* 690 */
+	{   389,   140,     0 },	/* 695 */
+	{   279,   101,     0 },	/* 700 */
+	{   199,    72,     0 },	/* 705 */
+	{   142,    51,     0 },	/* 710 */
+	{   101,    36,     0 },	/* 715 */
+	{    71,    26,     0 },	/* 720 */
+	{    50,    18,     0 },	/* 725 */
+	{    35,    13,     0 },	/* 730 */
+	{    25,     9,     0 },	/* 735 */
+	{    17,     6,     0 },	/* 740 */
+	{    12,     4,     0 },	/* 745 */
+	{     8,     3,     0 },	/* 750 */
+	{     6,     2,     0 },	/* 755 */
+	{     4,     1,     0 },	/* 760 */
+	{     3,     1,     0 },	/* 765 */
+	{     2,     1,     0 },	/* 770 */
+	{     1,     1,     0 },	/* 775 */
+	{     1,     0,     0 },	/* 780 */
+};
+
+/**
+ * chug_spectral_subtract_dark:
+ * @data: pixel values
+ * @dark: dark frame pixel values
+ * @len: number of pixels
+ *
+ * Subtracts the dark frame from the pixel values, saturating at zero.
+ **/
+void
+chug_spectral_subtract_dark(uint16_t *data, const uint16_t *dark, uint8_t len)
+{
+	uint8_t i;
+	for (i = 0; i < len; i++) {
+		if (data[i] > dark[i])
+			data[i] -= dark[i];
+		else
+			data[i] = 0;
+	}
+}
+
+/**
+ * chug_spectral_predict_integration:
+ * @probe_time: the integration time of the probe frame in ms
+ * @peak: the largest pixel value in the probe frame
+ * @target: the value the largest pixel should have
+ * @time_max: the longest integration time allowed in ms
+ *
+ * Predicts the integration time that puts the peak pixel at @target,
+ * assuming the sensor response is linear. If the probe frame is saturated
+ * the real peak is unknown, and so a quarter of the probe time is returned
+ * so that another probe frame can be taken.
+ *
+ * Returns: the integration time in ms, between 1 and @time_max
+ **/
+uint16_t
+chug_spectral_predict_integration(uint16_t probe_time,
+				  uint16_t peak,
+				  uint16_t target,
+				  uint16_t time_max)
+{
+	uint32_t tmp;
+
+	if (peak >= CH_SPECTRAL_ADC_SATURATED)
+		tmp = probe_time / 4;
+	else if (peak == 0)
+		tmp = time_max;
+	else
+		tmp = ((uint32_t) probe_time * target + peak / 2) / peak;
+	if (tmp > time_max)
+		tmp = time_max;
+	if (tmp < 1)
+		tmp = 1;
+	return tmp;
+}
+
+/* returns a * x / 64 for a Q10.6 pixel position without needing a 64 bit
+ * multiply, splitting a into its integer and fractional parts */
+static int32_t
+chug_spectral_mul_pos(int32_t a, uint16_t x)
+{
+	return (a >> 16) * (int32_t) x * 1024 +
+	       (int32_t) (((uint32_t) (a & 0xffff) * x) >> 6);
+}
+
+/**
+ * chug_spectral_get_wavelength:
+ * @cal: the wavelength calibration polynomial
+ * @pixel: the pixel index, 0 to 1023
+ *
+ * Evaluates the wavelength calibration, where wavelength_cal[k] is the
+ * coefficient of p^k in nm as Q16.16 fixed point. This is the packed float
+ * format the host uses for SET_CCD_CALIBRATION.
+ *
+ * Returns: the wavelength in nm as Q16.16 fixed point
+ **/
+int32_t
+chug_spectral_get_wavelength(const int32_t *cal, uint16_t pixel)
+{
+	return chug_spectral_get_wavelength_pos(cal, pixel << 6);
+}
+
+/**
+ * chug_spectral_get_wavelength_pos:
+ * @cal: the wavelength calibration polynomial
+ * @x: the Q10.6 pixel position
+ *
+ * Evaluates the wavelength calibration between pixels.
+ *
+ * Returns: the wavelength in nm as Q16.16 fixed point
+ **/
+int32_t
+chug_spectral_get_wavelength_pos(const int32_t *cal, uint16_t x)
+{
+	int32_t tmp;
+
+	/* Horner's method */
+	tmp = cal[3];
+	tmp = cal[2] + chug_spectral_mul_pos(tmp, x);
+	tmp = cal[1] + chug_spectral_mul_pos(tmp, x);
+	tmp = cal[0] + chug_spectral_mul_pos(tmp, x);
+	return tmp;
+}
+
+/**
+ * chug_spectral_index_init:
+ * @idx: A #ChSpectralIndex
+ * @cal: the wavelength calibration polynomial
+ *
+ * Sets up the helper to find the pixel positions of increasing wavelengths.
+ **/
+void
+chug_spectral_index_init(ChSpectralIndex *idx, const int32_t *cal)
+{
+	idx->cal = cal;
+	idx->pixel = 0;
+	idx->wl_lo = chug_spectral_get_wavelength(cal, 0);
+	idx->wl_hi = chug_spectral_get_wavelength(cal, 1);
+}
+
+/**
+ * chug_spectral_index_lookup:
+ * @idx: A #ChSpectralIndex
+ * @wavelength: in nm as Q16.16 fixed point
+ *
+ * Finds the pixel position of a wavelength by walking the calibration
+ * polynomial one pixel at a time and interpolating linearly between
+ * pixels. The wavelength must be no smaller than the last one looked up,
+ * which means a whole grid only evaluates the polynomial once per pixel.
+ *
+ * Returns: a Q10.6 pixel position, or %CH_SPECTRAL_INDEX_INVALID
+ **/
+uint16_t
+chug_spectral_index_lookup(ChSpectralIndex *idx, int32_t wavelength)
+{
+	/* before the first pixel */
+	if (wavelength < idx->wl_lo)
+		return CH_SPECTRAL_INDEX_INVALID;
+
+	/* find the pixels either side */
+	while (wavelength >= idx->wl_hi) {
+		if (idx->pixel >= CH_SPECTRAL_NUM_PIXELS - 2)
+			return CH_SPECTRAL_INDEX_INVALID;
+		idx->pixel++;
+		idx->wl_lo = idx->wl_hi;
+		idx->wl_hi = chug_spectral_get_wavelength(idx->cal, idx->pixel + 1);
+	}
+	return (idx->pixel << 6) +
+		((wavelength - idx->wl_lo) << 6) / (idx->wl_hi - idx->wl_lo);
+}
+
+/**
+ * chug_spectral_interpolate:
+ * @lo: the pixel value
+ * @hi: the next pixel value
+ * @frac: the position between the two pixels in 1/64ths
+ *
+ * Linearly interpolates between two pixel values.
+ *
+ * Returns: the interpolated value
+ **/
+uint16_t
+chug_spectral_interpolate(uint16_t lo, uint16_t hi, uint8_t frac)
+{
+	int32_t tmp = (int32_t) hi - (int32_t) lo;
+	return lo + ((tmp * frac + 32) >> 6);
+}
+
+/**
+ * chug_spectral_interpolate_peak:
+ * @lo: the value before the peak
+ * @peak: the local maximum
+ * @hi: the value after the peak
+ * @offset: (out): the vertex position relative to the peak in 1/64ths
+ *
+ * Fits a parabola through the three values around a local maximum, where
+ * @peak is higher than @lo and no lower than @hi.
+ *
+ * Returns: the value at the vertex
+ **/
+uint16_t
+chug_spectral_interpolate_peak(uint16_t lo,
+			       uint16_t peak,
+			       uint16_t hi,
+			       int8_t *offset)
+{
+	int32_t diff = (int32_t) lo - (int32_t) hi;
+	int32_t curve = (int32_t) lo + (int32_t) hi - 2 * (int32_t) peak;
+	int32_t tmp;
+
+	/* the curvature is negative and at least as large as the difference,
+	 * so this is within half a pixel */
+	*offset = (diff * 32) / curve;
+
+	/* the vertex is never lower than the peak */
+	tmp = peak + ((-diff * *offset) >> 8);
+	if (tmp > 0xffff)
+		return 0xffff;
+	return tmp;
+}
+
+/**
+ * chug_spectral_add_peaks:
+ * @win: @len + 2 * @width pixel values, where the first one checked is at
+ *  @win[@width]
+ * @len: the number of pixels to check
+ * @width: the number of pixels either side that are compared
+ * @pixel: the pixel index of @win[@width]
+ * @peaks: the highest peaks found so far, highest first
+ * @max: the size of @peaks
+ * @found: the number of peaks in @peaks
+ *
+ * Adds the local maxima in a run of pixels to a list of the highest peaks,
+ * dropping the lowest when the list is full. Each one is higher than the
+ * @width pixels before it and no lower than the @width pixels after it, so
+ * a plateau only gives one peak. The position is in Q10.6 pixels, using a
+ * parabola through the three values around the maximum.
+ *
+ * Returns: the new number of peaks in @peaks
+ **/
+uint8_t
+chug_spectral_add_peaks(const uint16_t *win,
+			uint8_t len,
+			uint8_t width,
+			uint16_t pixel,
+			ChSpectralPeak *peaks,
+			uint8_t max,
+			uint8_t found)
+{
+	uint16_t value;
+	uint8_t edge = 2 * width;
+	uint8_t j;
+	uint8_t k;
+	int8_t offset;
+
+	for (j = 0; j < len; j++) {
+		value = win[j + width];
+		for (k = 0; k < width; k++) {
+			if (win[j + k] >= value || win[j + edge - k] > value)
+				break;
+		}
+		if (k < width)
+			continue;
+		value = chug_spectral_interpolate_peak(win[j + width - 1],
+						       value,
+						       win[j + width + 1],
+						       &offset);
+
+		/* insert in order, dropping the lowest when full */
+		if (found == max && value <= peaks[max - 1].value)
+			continue;
+		if (found < max)
+			found++;
+		for (k = found - 1; k > 0 && peaks[k - 1].value < value; k--)
+			peaks[k] = peaks[k - 1];
+		peaks[k].value = value;
+		peaks[k].position = ((pixel + j) << 6) + offset;
+	}
+	return found;
+}
+
+/**
+ * chug_spectral_linearize:
+ * @lut: %CH_LINEARITY_POINTS non-decreasing corrected values
+ * @value: the raw pixel value
+ *
+ * Corrects the non-linear sensor response using a piecewise linear table,
+ * where entry n is the corrected value for a raw value of n * 2048 and
+ * the final entry is for a raw value of 0x10000.
+ *
+ * Returns: the corrected value
+ **/
+uint16_t
+chug_spectral_linearize(const uint16_t *lut, uint16_t value)
+{
+	uint8_t idx = value >> CH_LINEARITY_SHIFT;
+	uint16_t frac = value & ((1 << CH_LINEARITY_SHIFT) - 1);
+	uint16_t lo = lut[idx];
+	uint32_t tmp = (uint32_t) (lut[idx + 1] - lo) * frac;
+	return lo + ((tmp + (1 << (CH_LINEARITY_SHIFT - 1))) >> CH_LINEARITY_SHIFT);
+}
+
+/**
+ * chug_spectral_smooth_pixel:
+ * @win: @taps consecutive pixel values, centred on the pixel to smooth
+ * @taps: 5 or 9
+ *
+ * Applies a quadratic Savitzky-Golay smoothing filter to one pixel, using
+ * the symmetry of the coefficients to halve the number of multiplies.
+ *
+ * Returns: the smoothed value, clamped to the pixel range
+ **/
+uint16_t
+chug_spectral_smooth_pixel(const uint16_t *win, uint8_t taps)
+{
+	const int16_t *coef = _sg5;
+	int32_t sum;
+	uint8_t half = taps / 2;
+	uint8_t k;
+
+	if (taps == 9)
+		coef = _sg9;
+	sum = (int32_t) coef[0] * win[half];
+	for (k = 1; k <= half; k++)
+		sum += (int32_t) coef[k] * ((int32_t) win[half - k] + win[half + k]);
+
+	/* the negative lobes can overshoot at sharp edges */
+	sum += 1 << (CH_SPECTRAL_SMOOTH_SHIFT - 1);
+	if (sum < 0)
+		return 0;
+	sum >>= CH_SPECTRAL_SMOOTH_SHIFT;
+	if (sum > 0xffff)
+		return 0xffff;
+	return sum;
+}
+
+/**
+ * chug_spectral_add_xyz:
+ * @xyz: the three accumulators
+ * @idx: the index into the CIE table, where 0 is 380nm
+ * @value: the spectrum value at the wavelength
+ *
+ * Adds a spectrum value weighted by the colour matching functions. Once
+ * all %CH_SPECTRAL_CIE_POINTS wavelengths have been added the XYZ values
+ * are Q24.8 fixed point, in the same units as the pixel values.
+ **/
+void
+chug_spectral_add_xyz(uint32_t *xyz, uint8_t idx, uint16_t value)
+{
+	uint8_t i;
+	for (i = 0; i < 3; i++)
+		xyz[i] += ((uint32_t) value * _cie1931[idx][i]) >> 11;
+}
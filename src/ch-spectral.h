@@ -0,0 +1,93 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef __CH_SPECTRAL_H
+#define __CH_SPECTRAL_H
+
+#include <stdint.h>
+
+#include "ColorHug.h"
+
+/* the largest value the left justified 10 bit ADC can return */
+#define CH_SPECTRAL_ADC_SATURATED	0xffc0
+
+#define CH_SPECTRAL_NUM_PIXELS		1024
+
+/* CIE 1931 2 degree observer, 380-780nm in 5nm steps */
+#define CH_SPECTRAL_CIE_START		380
+#define CH_SPECTRAL_CIE_STEP		5
+#define CH_SPECTRAL_CIE_POINTS		81
+
+/* raw values between the linearity table entries */
+#define CH_LINEARITY_SHIFT		11
+
+/* the widest smoothing filter */
+#define CH_SPECTRAL_SMOOTH_TAPS_MAX	9
+
+/* pixel positions are Q10.6 fixed point */
+#define CH_SPECTRAL_INDEX_INVALID	0xffff
+
+typedef struct {
+	const int32_t	*cal;
+	uint16_t	 pixel;
+	int32_t		 wl_lo;			/* at pixel */
+	int32_t		 wl_hi;			/* at pixel + 1 */
+} ChSpectralIndex;
+
+void		 chug_spectral_subtract_dark	(uint16_t	*data,
+						 const uint16_t	*dark,
+						 uint8_t	 len);
+uint16_t	 chug_spectral_predict_integration (uint16_t	 probe_time,
+						 uint16_t	 peak,
+						 uint16_t	 target,
+						 uint16_t	 time_max);
+int32_t		 chug_spectral_get_wavelength	(const int32_t	*cal,
+						 uint16_t	 pixel);
+int32_t		 chug_spectral_get_wavelength_pos (const int32_t	*cal,
+						 uint16_t	 x);
+void		 chug_spectral_index_init	(ChSpectralIndex *idx,
+						 const int32_t	*cal);
+uint16_t	 chug_spectral_index_lookup	(ChSpectralIndex *idx,
+						 int32_t	 wavelength);
+uint16_t	 chug_spectral_interpolate	(uint16_t	 lo,
+						 uint16_t	 hi,
+						 uint8_t	 frac);
+uint16_t	 chug_spectral_interpolate_peak	(uint16_t	 lo,
+						 uint16_t	 peak,
+						 uint16_t	 hi,
+						 int8_t		*offset);
+uint8_t		 chug_spectral_add_peaks	(const uint16_t	*win,
+						 uint8_t	 len,
+						 uint8_t	 width,
+						 uint16_t	 pixel,
+						 ChSpectralPeak	*peaks,
+						 uint8_t	 max,
+						 uint8_t	 found);
+uint16_t	 chug_spectral_linearize	(const uint16_t	*lut,
+						 uint16_t	 value);
+uint16_t	 chug_spectral_smooth_pixel	(const uint16_t	*win,
+						 uint8_t	 taps);
+void		 chug_spectral_add_xyz		(uint32_t	*xyz,
+						 uint8_t	 idx,
+						 uint16_t	 value);
+
+#endif /* __CH_SPECTRAL_H */
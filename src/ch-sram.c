@@ -0,0 +1,97 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "ch-sram.h"
+
+/* the accumulator is only used when averaging, and so shares the top half
+ * with the streaming slot and the resampling tables; a region is claimed
+ * while its contents are needed, so only one of them is live at a time */
+static const ChSramRegion _sram_regions[CH_SRAM_REGION_LAST] = {
+	/* shadow, the whole SRAM */
+	{ 0x0000, CH_SRAM_SIZE, CH_SRAM_REGION_FLAG_FLASH, 0 },
+	/* spectrum, 1024 x uint16_t */
+	{ 0x0000, 0x0800, CH_SRAM_REGION_FLAG_NONE, 0 },
+	/* spectrum alt, 1024 x uint16_t when pipelined */
+	{ 0x1000, 0x0800, CH_SRAM_REGION_FLAG_SHARED, 0 },
+	/* dark, 1024 x uint16_t */
+	{ 0x0800, 0x0800, CH_SRAM_REGION_FLAG_NONE, 0 },
+	/* accumulator, 1024 x uint32_t */
+	{ 0x1000, 0x1000, CH_SRAM_REGION_FLAG_SHARED, 0 },
+	/* resample index, 512 x uint16_t Q10.6 */
+	{ 0x1800, 0x0400, CH_SRAM_REGION_FLAG_SHARED, 0 },
+	/* resampled, 512 x uint16_t */
+	{ 0x1c00, 0x0400, CH_SRAM_REGION_FLAG_SHARED, 0 }
+};
+
+/* the number of bytes in use at the start of each region, or 0 */
+static uint16_t _sram_live[CH_SRAM_REGION_LAST];
+
+const ChSramRegion *
+chug_sram_get_region(ChSramRegionId id)
+{
+	return &_sram_regions[id];
+}
+
+/* returns TRUE if any of the SRAM range is inside the region */
+uint8_t
+chug_sram_region_overlaps(ChSramRegionId id, uint16_t addr, uint16_t len)
+{
+	const ChSramRegion *region = &_sram_regions[id];
+	return addr < region->offset + region->size &&
+	       addr + len > region->offset;
+}
+
+/*
+ * Marks the first @len bytes of a region as in use. This fails if they
+ * overlap the used part of any other live region, and claiming a region
+ * that is already live just changes the length.
+ */
+ChError
+chug_sram_claim(ChSramRegionId id, uint16_t len)
+{
+	const uint16_t offset = _sram_regions[id].offset;
+	uint8_t i;
+
+	if (len > _sram_regions[id].size)
+		return CH_ERROR_INVALID_LENGTH;
+	for (i = CH_SRAM_REGION_SPECTRUM; i < CH_SRAM_REGION_LAST; i++) {
+		if (i == id || _sram_live[i] == 0)
+			continue;
+		if (offset < _sram_regions[i].offset + _sram_live[i] &&
+		    offset + len > _sram_regions[i].offset)
+			return CH_ERROR_OUT_OF_MEMORY;
+	}
+	_sram_live[id] = len;
+	return CH_ERROR_NONE;
+}
+
+void
+chug_sram_release(ChSramRegionId id)
+{
+	_sram_live[id] = 0;
+}
+
+uint8_t
+chug_sram_is_live(ChSramRegionId id)
+{
+	return _sram_live[id] != 0;
+}
@@ -0,0 +1,41 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef __CH_SRAM_H
+#define __CH_SRAM_H
+
+#include <stdint.h>
+
+#include "ColorHug.h"
+
+#define CH_SRAM_SIZE			0x2000
+
+const ChSramRegion	*chug_sram_get_region		(ChSramRegionId	 id);
+uint8_t		 chug_sram_region_overlaps	(ChSramRegionId	 id,
+						 uint16_t	 addr,
+						 uint16_t	 len);
+ChError		 chug_sram_claim		(ChSramRegionId	 id,
+						 uint16_t	 len);
+void		 chug_sram_release		(ChSramRegionId	 id);
+uint8_t		 chug_sram_is_live		(ChSramRegionId	 id);
+
+#endif /* __CH_SRAM_H */
@@ -0,0 +1,218 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "ch-timer.h"
+
+/* Timer0 runs at 46875Hz on both clock variants, i.e. 375 ticks per 8ms */
+#define CH_TIMER_TICKS_PER_8MS		375
+
+static uint32_t	 _timer_ms = 0;
+static uint16_t	 _timer_last = 0;
+static uint16_t	 _timer_remainder = 0;
+
+/* waits are split so a deadline is never more than half the counter away */
+#define CH_TIMER_WAIT_US_MAX		10000
+
+/**
+ * chug_timer_init:
+ *
+ * Sets up Timer0 as a free-running 16 bit counter for ms timing, and
+ * Timer1 as a free-running 16 bit counter for us timing.
+ **/
+void
+chug_timer_init(void)
+{
+	T0CONbits.TMR0ON = 0;
+	T0CONbits.T08BIT = 0;		/* 16 bit */
+	T0CONbits.T0CS = 0;		/* internal instruction clock */
+	T0CONbits.PSA = 0;		/* use the prescaler */
+#ifdef HAVE_24MHZ
+	T0CONbits.T0PS = 0b110;		/* 6MHz / 128 */
+#else
+	T0CONbits.T0PS = 0b111;		/* 12MHz / 256 */
+#endif
+	TMR0H = 0;
+	TMR0L = 0;
+	INTCONbits.TMR0IF = 0;		/* polled, never enabled */
+	_timer_ms = 0;
+	_timer_last = 0;
+	_timer_remainder = 0;
+	T0CONbits.TMR0ON = 1;
+
+	T1CONbits.TMR1ON = 0;
+	T1CONbits.TMR1CS = 0b00;	/* internal instruction clock */
+	T1CONbits.T1OSCEN = 0;
+	T1CONbits.RD16 = 1;		/* read both bytes at once */
+#ifdef HAVE_24MHZ
+	T1CONbits.T1CKPS = 0b01;	/* 6MHz / 2 */
+#else
+	T1CONbits.T1CKPS = 0b10;	/* 12MHz / 4 */
+#endif
+	TMR1H = 0;
+	TMR1L = 0;
+	T1CONbits.TMR1ON = 1;
+}
+
+/**
+ * chug_timer_get_ms:
+ *
+ * Gets the number of milliseconds since the timer was started.
+ *
+ * The counter wraps every 1.39 seconds, and the overflow flag records one
+ * wrap between calls, so the returned value stays accurate as long as the
+ * counter does not wrap twice between two calls. This is always true when
+ * called at least every 1.39 seconds, and the main loop does so to keep
+ * the value current for everything else.
+ *
+ * Return value: a monotonic time in ms
+ **/
+uint32_t
+chug_timer_get_ms(void)
+{
+	uint8_t wrapped;
+	uint16_t now;
+	uint32_t tmp;
+
+	/* reading TMR0L latches TMR0H, and the flag must belong to the
+	 * same count, so read again if it was set in between */
+	do {
+		wrapped = INTCONbits.TMR0IF;
+		now = TMR0L;
+		now |= ((uint16_t) TMR0H) << 8;
+	} while (wrapped != INTCONbits.TMR0IF);
+
+	/* it takes another 1.39s to wrap again, so this cannot lose one */
+	if (wrapped)
+		INTCONbits.TMR0IF = 0;
+
+	/* add the elapsed ticks, where a count no lower than last time
+	 * with the flag set is a whole cycle later */
+	tmp = ((uint32_t) (uint16_t) (now - _timer_last)) * 8;
+	if (wrapped && now >= _timer_last)
+		tmp += 0x10000UL * 8;
+	tmp += _timer_remainder;
+	_timer_last = now;
+	_timer_ms += tmp / CH_TIMER_TICKS_PER_8MS;
+	_timer_remainder = tmp % CH_TIMER_TICKS_PER_8MS;
+	return _timer_ms;
+}
+
+/**
+ * chug_timer_get_us:
+ *
+ * Gets the number of microseconds since the timer was started, with the
+ * 21us resolution of Timer0. This wraps every 71 minutes, but differences
+ * between two values are correct for periods of up to 1.39 seconds.
+ *
+ * Return value: a time in us
+ **/
+uint32_t
+chug_timer_get_us(void)
+{
+	uint32_t ms = chug_timer_get_ms();
+
+	/* the remainder is in units of 8/3 us */
+	return ms * 1000 + (_timer_remainder * 8) / 3;
+}
+
+/**
+ * chug_timer_get_ticks:
+ *
+ * Gets the raw Timer1 counter, which runs at %CH_TIMER_TICKS_PER_US on
+ * both clock variants and wraps every 21.8ms.
+ *
+ * Return value: a counter value
+ **/
+uint16_t
+chug_timer_get_ticks(void)
+{
+	uint16_t now;
+
+	/* reading TMR1L latches TMR1H */
+	now = TMR1L;
+	now |= ((uint16_t) TMR1H) << 8;
+	return now;
+}
+
+/**
+ * chug_timer_get_deadline:
+ * @us: the time from now, up to 10ms
+ *
+ * Gets a deadline that can be checked with chug_timer_deadline_passed().
+ *
+ * Return value: a counter value
+ **/
+uint16_t
+chug_timer_get_deadline(uint16_t us)
+{
+	return chug_timer_get_ticks() + CH_TIMER_US_TO_TICKS(us);
+}
+
+/**
+ * chug_timer_deadline_passed:
+ * @deadline: a counter value, e.g. from chug_timer_get_deadline()
+ *
+ * Checks if a deadline has been reached. This has to be called within
+ * 10ms of the deadline, after which the counter has wrapped too far for
+ * the result to be valid.
+ *
+ * Return value: %TRUE if the deadline has been reached
+ **/
+uint8_t
+chug_timer_deadline_passed(uint16_t deadline)
+{
+	return (int16_t) (chug_timer_get_ticks() - deadline) >= 0;
+}
+
+/**
+ * chug_timer_wait_deadline:
+ * @deadline: a counter value, e.g. from chug_timer_get_deadline()
+ *
+ * Waits until a deadline has been reached, returning straight away if it
+ * already has.
+ **/
+void
+chug_timer_wait_deadline(uint16_t deadline)
+{
+	while (!chug_timer_deadline_passed(deadline))
+		CLRWDT();
+}
+
+/**
+ * chug_timer_wait_us:
+ * @us: the time to wait
+ *
+ * Waits for at least the given time. The call itself takes a few us, so
+ * very short waits will be longer than asked for.
+ **/
+void
+chug_timer_wait_us(uint16_t us)
+{
+	uint16_t chunk;
+
+	while (us > 0) {
+		chunk = us;
+		if (chunk > CH_TIMER_WAIT_US_MAX)
+			chunk = CH_TIMER_WAIT_US_MAX;
+		chug_timer_wait_deadline(chug_timer_get_deadline(chunk));
+		us -= chunk;
+	}
+}
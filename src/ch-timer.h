@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_TIMER_H
+#define __CH_TIMER_H
+
+#include <xc.h>
+#include <stdint.h>
+
+/* Timer1 runs at 3MHz on both clock variants */
+#define CH_TIMER_TICKS_PER_US		3
+#define CH_TIMER_TICKS_PER_MS		3000
+#define CH_TIMER_US_TO_TICKS(us)	((uint16_t) ((us) * CH_TIMER_TICKS_PER_US))
+#define CH_TIMER_TICKS_TO_US(ticks)	((ticks) / CH_TIMER_TICKS_PER_US)
+
+void		 chug_timer_init		(void);
+uint32_t	 chug_timer_get_ms		(void);
+uint32_t	 chug_timer_get_us		(void);
+uint16_t	 chug_timer_get_ticks		(void);
+uint16_t	 chug_timer_get_deadline	(uint16_t	 us);
+uint8_t		 chug_timer_deadline_passed	(uint16_t	 deadline);
+void		 chug_timer_wait_deadline	(uint16_t	 deadline);
+void		 chug_timer_wait_us		(uint16_t	 us);
+
+#endif /* __CH_TIMER_H */
@@ -31,6 +31,7 @@
 
 #include "ch-config.h"
 #include "ch-errno.h"
+#include "ch-timer.h"
 
 static CHugConfig _cfg;
 
@@ -56,6 +57,9 @@ main(void)
 	OSCTUNEbits.PLLEN = 1;
 	while (pll_startup--);
 
+	/* used for showing errors */
+	chug_timer_init();
+
 /* Configure interrupts, per architecture */
 #ifdef USB_USE_INTERRUPTS
 	INTCONbits.PEIE = 1;
@@ -35,8 +35,13 @@
 #include "mzt_mcdc04.h"
 
 #include "ch-config.h"
+#include "ch-crc.h"
 #include "ch-errno.h"
 #include "ch-flash.h"
+#include "ch-encode.h"
+#include "ch-spectral.h"
+#include "ch-sram.h"
+#include "ch-timer.h"
 
 static CHugConfig		 _cfg;
 static ChError			 _last_error = CH_ERROR_NONE;
@@ -49,8 +54,108 @@ static uint16_t			 _heartbeat_cnt = 0;
 MztMcdc04Context		 _mcdc04_ctx;
 #endif
 
+#ifdef HAVE_ELIS1024
+OoElis1024Context		 _elis1024_ctx;
+static uint16_t			 _spectral_flags = CH_SPECTRAL_FLAG_NONE;
+static ChSpectralHeader		 _spectral_header;
+static uint32_t			 _spectral_timestamp = 0;	/* ms */
+static ChSpectralStats		 _spectral_stats;
+static uint8_t			 _spectral_pending = FALSE;
+static uint8_t			 _spectral_resample = FALSE;
+static uint8_t			 _spectral_smooth = 0;		/* taps */
+static uint32_t			 _spectral_smooth_time = 0;	/* us */
+static uint16_t			 _spectral_sequence = 0;
+static uint16_t			 _spectral_offset = 0;
+
+/* TAKE_READING_XYZ results, computed when the reading completes */
+static int32_t			 _spectral_xyz[3];
+static uint8_t			 _spectral_xyz_pending = FALSE;
+static uint8_t			 _spectral_xyz_valid = FALSE;
+
+/* sensor pixels in ascending order, loaded from flash */
+static uint16_t			 _hot_pixels[CH_HOT_PIXELS_MAX];
+static uint8_t			 _hot_pixel_count = 0;
+
+/* sensor response correction, loaded from flash */
+static uint16_t			 _linearity[CH_LINEARITY_POINTS];
+static uint8_t			 _linearity_valid = FALSE;
+
+/* uniform nm grid, defaulting to 380-730nm in 1nm steps */
+static uint16_t			 _resample_start = 380;
+static uint16_t			 _resample_step = 1;
+static uint16_t			 _resample_count = 351;
+static uint8_t			 _resample_index_valid = FALSE;
+
+/* the cached dark frame is only valid for the conditions it was taken in */
+static uint8_t			 _dark_valid = FALSE;
+static uint8_t			 _dark_pending = FALSE;
+static uint16_t			 _dark_integration_time = 0;
+static uint16_t			 _dark_pixel_start = 0;
+static uint16_t			 _dark_pixel_length = 0;
+static uint8_t			 _dark_binning = 0;
+static int32_t			 _dark_temperature = 0;
+
+/* frames are acquired and then sent on EP1 until streaming is stopped */
+typedef enum {
+	CH_STREAM_STATE_IDLE,
+	CH_STREAM_STATE_ACQUIRING,
+	CH_STREAM_STATE_SENDING
+} ChStreamState;
+
+static ChStreamState		 _stream_state = CH_STREAM_STATE_IDLE;
+static ChSpectralStreamHeader	 _stream_header;
+static uint16_t			 _stream_frames = 1;
+static uint16_t			 _stream_sequence = 0;
+static uint16_t			 _stream_sequence_start = 0;
+static uint8_t			 _stream_pipelined = FALSE;
+static uint16_t			 _stream_addr = 0;
+static uint16_t			 _stream_len = 0;
+static uint16_t			 _stream_sent = 0;
+static uint8_t			 _stream_zlp = FALSE;
+static uint8_t			 _stream_dma_busy = FALSE;
+static uint16_t			 _stream_dma_len = 0;
+#endif
+
+#ifdef HAVE_SRAM
+/* a READ_SRAM_BULK range being sent, or a WRITE_SRAM_BULK range being
+ * received, on EP1 */
+static uint8_t			 _sram_bulk_write = FALSE;
+static uint16_t			 _sram_bulk_addr = 0;
+static uint16_t			 _sram_bulk_len = 0;
+static uint16_t			 _sram_bulk_sent = 0;
+static uint8_t			 _sram_bulk_zlp = FALSE;
+static uint8_t			 _sram_bulk_dma_busy = FALSE;
+static uint16_t			 _sram_bulk_dma_len = 0;
+#endif
+
+/* 2.0C in the TCN75A fixed point format */
+#define CH_DARK_TEMPERATURE_DRIFT	0x20000
+
 #define CH_SRAM_ADDRESS_WRDS		0x6000
 
+/* a whole erase block below the config words, shared by the hot pixels and
+ * the linearity table; DFU of an older and larger image can overwrite it, so
+ * each table is a record that is only used if it checks out */
+#define CH_CALIBRATION_ADDRESS_WRDS	0xf800
+#define CH_HOT_PIXELS_ADDRESS_WRDS	0xf800
+#define CH_LINEARITY_ADDRESS_WRDS	0xf880
+#define CH_HOT_PIXELS_MAGIC		0x5048	/* "HP" */
+#define CH_LINEARITY_MAGIC		0x4e4c	/* "LN" */
+
+typedef struct {
+	uint16_t	 magic;
+	uint16_t	 len;
+	uint16_t	 checksum;
+} ChCalibrationHeader;
+
+/* the SRAM layout is the region table in ch-sram.c */
+#define CH_SRAM_OFFSET(id)		(chug_sram_get_region(id)->offset)
+
+#define CH_RESAMPLE_POINTS_MAX		512
+#define CH_RESAMPLE_CHUNK		16
+#define CH_SMOOTH_CHUNK			16
+#define CH_PEAK_CHUNK			16
+
 void
 chug_usb_dfu_set_success_callback(void *context)
 {
@@ -146,9 +251,25 @@ _send_data_stage_cb(bool transfer_ok, void *context)
 	return 0;
 }
 
+/* the host has changed the SRAM contents */
+static void
+chug_sram_changed(uint16_t addr, uint16_t len)
+{
+#ifdef HAVE_ELIS1024
+	/* the resample index table has been overwritten */
+	if (chug_sram_region_overlaps(CH_SRAM_REGION_RESAMPLE_INDEX, addr, len))
+		_resample_index_valid = FALSE;
+
+	/* the cached dark frame cannot be subtracted any more */
+	if (chug_sram_region_overlaps(CH_SRAM_REGION_DARK, addr, len))
+		_dark_valid = FALSE;
+#endif
+}
+
 static int8_t
 chug_flash_load_sram(uint16_t addr, uint16_t len)
 {
+	const uint16_t sram = CH_SRAM_OFFSET(CH_SRAM_REGION_SHADOW);
 	uint16_t i;
 	uint8_t rc;
 	const uint16_t buflen = sizeof(_chug_buf);
@@ -160,9 +281,10 @@ chug_flash_load_sram(uint16_t addr, uint16_t len)
 			chug_set_error(CH_CMD_LOAD_SRAM, rc);
 			return -1;
 		}
-		mti_23k640_dma_from_cpu(_chug_buf, i, buflen);
+		mti_23k640_dma_from_cpu(_chug_buf, sram + i, buflen);
 		mti_23k640_dma_wait();
 	}
+	chug_sram_changed(sram, len);
 	usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
 	return 0;
 }
@@ -170,6 +292,7 @@ chug_flash_load_sram(uint16_t addr, uint16_t len)
 static int8_t
 chug_flash_save_sram (uint16_t addr, uint16_t len)
 {
+	const uint16_t sram = CH_SRAM_OFFSET(CH_SRAM_REGION_SHADOW);
 	uint16_t i;
 	uint8_t rc;
 	const uint16_t buflen = sizeof(_chug_buf);
@@ -183,7 +306,7 @@ chug_flash_save_sram (uint16_t addr, uint16_t len)
 
 	/* copy from SRAM to EEPROM */
 	for (i = 0; i < len; i += buflen) {
-		mti_23k640_dma_to_cpu(i, _chug_buf, buflen);
+		mti_23k640_dma_to_cpu(sram + i, _chug_buf, buflen);
 		mti_23k640_dma_wait();
 		rc = chug_flash_write(addr + i, _chug_buf, buflen);
 		if (rc != 0) {
@@ -195,6 +318,823 @@ chug_flash_save_sram (uint16_t addr, uint16_t len)
 	return 0;
 }
 
+#ifdef HAVE_ELIS1024
+/*
+ * Converts the uniform wavelength grid to Q10.6 sensor pixel positions.
+ * This is only done when the calibration or grid changes, or when the
+ * table has been overwritten in the SRAM.
+ */
+static void
+chug_resample_build_index(void)
+{
+	const uint16_t sram = CH_SRAM_OFFSET(CH_SRAM_REGION_RESAMPLE_INDEX);
+	ChSpectralIndex helper;
+	uint16_t buf[CH_RESAMPLE_CHUNK];
+	uint16_t i;
+	uint8_t j = 0;
+	uint32_t wavelength;
+
+	chug_spectral_index_init(&helper, _cfg.wavelength_cal);
+	for (i = 0; i < _resample_count; i++) {
+		wavelength = _resample_start + (uint32_t) i * _resample_step;
+		buf[j++] = chug_spectral_index_lookup(&helper, wavelength << 16);
+		if (j < CH_RESAMPLE_CHUNK && i < _resample_count - 1)
+			continue;
+		mti_23k640_dma_from_cpu((const uint8_t *) buf,
+					sram + (i + 1 - j) * sizeof(uint16_t),
+					j * sizeof(uint16_t));
+		mti_23k640_dma_wait();
+		j = 0;
+	}
+	_resample_index_valid = TRUE;
+}
+
+/*
+ * Averaging uses the shared top half of the SRAM, so it replaces the last
+ * resampled spectrum unless the stream is still sending it, and cannot be
+ * used at all while the stream has a frame in the second slot.
+ */
+static ChError
+chug_spectral_claim_accumulator(uint16_t frames)
+{
+	ChError rc;
+	uint16_t len;
+	if (frames <= 1)
+		return CH_ERROR_NONE;
+	if (_stream_state == CH_STREAM_STATE_SENDING &&
+	    _stream_sent != _stream_len)
+		return CH_ERROR_DEVICE_BUSY;
+	chug_sram_release(CH_SRAM_REGION_RESAMPLED);
+	len = oo_elis1024_get_pixel_count(&_elis1024_ctx) * sizeof(uint32_t);
+	rc = chug_sram_claim(CH_SRAM_REGION_ACCUMULATOR, len);
+	if (rc != CH_ERROR_NONE)
+		return rc;
+
+	/* the resample index is rebuilt when next needed */
+	if (chug_sram_region_overlaps(CH_SRAM_REGION_RESAMPLE_INDEX,
+				      CH_SRAM_OFFSET(CH_SRAM_REGION_ACCUMULATOR),
+				      len))
+		_resample_index_valid = FALSE;
+	return CH_ERROR_NONE;
+}
+
+/*
+ * Gets the stored spectrum value at a Q10.6 sensor pixel position. This
+ * is mapped to the stored window and binning and interpolated linearly,
+ * and positions outside the stored window are zero.
+ */
+static uint16_t
+chug_spectral_get_value(uint16_t pos)
+{
+	uint16_t px[2];
+	uint16_t base;
+	uint16_t last;
+
+	/* the middle of the first bin, and the last stored value */
+	base = (_elis1024_ctx.pixel_start << 6) +
+	       ((_elis1024_ctx.binning - 1) << 5);
+	last = (oo_elis1024_get_pixel_count(&_elis1024_ctx) - 1) << 6;
+	if (pos == CH_SPECTRAL_INDEX_INVALID || pos < base)
+		return 0;
+	pos = (pos - base) / _elis1024_ctx.binning;
+	if (pos > last)
+		return 0;
+
+	/* no need to fetch the next value if exact */
+	mti_23k640_dma_to_cpu(_spectral_offset + (pos >> 6) * 2,
+			      (uint8_t *) px,
+			      (pos & 0x3f) ? 4 : 2);
+	mti_23k640_dma_wait();
+	if ((pos & 0x3f) == 0)
+		return px[0];
+	return chug_spectral_interpolate(px[0], px[1], pos & 0x3f);
+}
+
+/* resamples the stored spectrum onto the wavelength grid, which is kept
+ * until the next averaged reading; the index is only a cache */
+static ChError
+chug_resample_spectrum(void)
+{
+	const uint16_t sram_index = CH_SRAM_OFFSET(CH_SRAM_REGION_RESAMPLE_INDEX);
+	const uint16_t sram_out = CH_SRAM_OFFSET(CH_SRAM_REGION_RESAMPLED);
+	uint16_t idx[CH_RESAMPLE_CHUNK];
+	uint16_t out[CH_RESAMPLE_CHUNK];
+	uint16_t i;
+	uint8_t j;
+	uint8_t len = CH_RESAMPLE_CHUNK;
+	ChError rc;
+
+	rc = chug_sram_claim(CH_SRAM_REGION_RESAMPLE_INDEX,
+			     _resample_count * sizeof(uint16_t));
+	if (rc != CH_ERROR_NONE)
+		return rc;
+	rc = chug_sram_claim(CH_SRAM_REGION_RESAMPLED,
+			     _resample_count * sizeof(uint16_t));
+	if (rc != CH_ERROR_NONE)
+		goto out;
+	if (!_resample_index_valid)
+		chug_resample_build_index();
+
+	for (i = 0; i < _resample_count; i += len) {
+		if (_resample_count - i < CH_RESAMPLE_CHUNK)
+			len = _resample_count - i;
+		mti_23k640_dma_to_cpu(sram_index + i * 2,
+				      (uint8_t *) idx, len * sizeof(uint16_t));
+		mti_23k640_dma_wait();
+		for (j = 0; j < len; j++)
+			out[j] = chug_spectral_get_value(idx[j]);
+		mti_23k640_dma_from_cpu((const uint8_t *) out,
+					sram_out + i * 2,
+					len * sizeof(uint16_t));
+		mti_23k640_dma_wait();
+	}
+out:
+	chug_sram_release(CH_SRAM_REGION_RESAMPLE_INDEX);
+	return rc;
+}
+
+/*
+ * Smooths @count pixels at @offset in place, a chunk at a time. The raw
+ * pixels that the next chunk still needs are kept at the start of the
+ * window, as the SRAM copies have already been overwritten. Pixels too
+ * close to either end for a whole window are left unchanged.
+ */
+static void
+chug_spectral_smooth(uint16_t offset, uint16_t count, uint8_t taps)
+{
+	uint16_t win[CH_SMOOTH_CHUNK + CH_SPECTRAL_SMOOTH_TAPS_MAX - 1];
+	uint16_t i;
+	uint16_t end;
+	uint8_t half = taps / 2;
+	uint8_t edge = taps - 1;
+	uint8_t j;
+	uint8_t len = CH_SMOOTH_CHUNK;
+
+	if (count < taps)
+		return;
+	end = count - half;
+	mti_23k640_dma_to_cpu(offset, (uint8_t *) win, edge * sizeof(uint16_t));
+	mti_23k640_dma_wait();
+	for (i = half; i < end; i += len) {
+		if (end - i < CH_SMOOTH_CHUNK)
+			len = end - i;
+		mti_23k640_dma_to_cpu(offset + (i + half) * sizeof(uint16_t),
+				      (uint8_t *) &win[edge],
+				      len * sizeof(uint16_t));
+		mti_23k640_dma_wait();
+
+		/* each result only replaces a raw pixel no longer needed */
+		for (j = 0; j < len; j++)
+			win[j] = chug_spectral_smooth_pixel(&win[j], taps);
+		mti_23k640_dma_from_cpu((const uint8_t *) win,
+					offset + i * sizeof(uint16_t),
+					len * sizeof(uint16_t));
+		mti_23k640_dma_wait();
+		for (j = 0; j < edge; j++)
+			win[j] = win[len + j];
+	}
+}
+
+/*
+ * Finds the highest local maxima of the stored spectrum, highest first,
+ * where peaks within @width pixels of either end are not found.
+ */
+static uint8_t
+chug_spectral_find_peaks(ChSpectralPeak *peaks, uint8_t max, uint8_t width)
+{
+	uint16_t win[CH_PEAK_CHUNK + 2 * CH_SPECTRAL_PEAK_WIDTH_MAX];
+	uint16_t count = _spectral_header.pixel_count;
+	uint16_t i;
+	uint16_t end;
+	uint16_t value;
+	uint16_t base;
+	uint16_t addr;
+	uint8_t edge = 2 * width;
+	uint8_t found = 0;
+	uint8_t j;
+	uint8_t k;
+	uint8_t len = CH_PEAK_CHUNK;
+
+	if (count <= edge)
+		return 0;
+	end = count - width;
+	mti_23k640_dma_to_cpu(_spectral_offset, (uint8_t *) win,
+			      edge * sizeof(uint16_t));
+	mti_23k640_dma_wait();
+	for (i = width; i < end; i += len) {
+		if (end - i < CH_PEAK_CHUNK)
+			len = end - i;
+		addr = _spectral_offset + (i + width) * sizeof(uint16_t);
+		mti_23k640_dma_to_cpu(addr, (uint8_t *) &win[edge],
+				      len * sizeof(uint16_t));
+		mti_23k640_dma_wait();
+
+		/* pixel i is at win[width] */
+		found = chug_spectral_add_peaks(win, len, width, i,
+						peaks, max, found);
+		for (j = 0; j < edge; j++)
+			win[j] = win[len + j];
+	}
+
+	/* only convert the peaks that are returned to wavelengths */
+	base = (_spectral_header.pixel_start << 6) +
+	       ((_spectral_header.binning - 1) << 5);
+	for (k = 0; k < found; k++) {
+		value = base + peaks[k].position * _spectral_header.binning;
+		peaks[k].position = value;
+		peaks[k].wavelength =
+			chug_spectral_get_wavelength_pos(_cfg.wavelength_cal,
+							 value);
+	}
+	return found;
+}
+
+/*
+ * Integrates the stored spectrum with the CIE 1931 colour matching
+ * functions. This walks the 5nm CIE wavelengths directly rather than using
+ * the resample grid, so it works whatever grid the host has chosen.
+ */
+static void
+chug_spectral_get_xyz(int32_t *xyz)
+{
+	ChSpectralIndex helper;
+	uint16_t pos;
+	uint32_t wavelength;
+	uint8_t i;
+
+	memset(xyz, 0, sizeof(int32_t) * 3);
+	chug_spectral_index_init(&helper, _cfg.wavelength_cal);
+	for (i = 0; i < CH_SPECTRAL_CIE_POINTS; i++) {
+		wavelength = CH_SPECTRAL_CIE_START + i * CH_SPECTRAL_CIE_STEP;
+		pos = chug_spectral_index_lookup(&helper, wavelength << 16);
+		chug_spectral_add_xyz((uint32_t *) xyz, i,
+				      chug_spectral_get_value(pos));
+	}
+}
+
+static void
+chug_spectral_poll(void)
+{
+	uint8_t rc;
+	uint16_t sequence;
+	uint32_t start_us;
+	rc = oo_elis1024_poll(&_elis1024_ctx);
+
+	/* the sums are not needed once the reading has finished */
+	if (oo_elis1024_get_state(&_elis1024_ctx) == CH_SPECTRAL_STATE_IDLE)
+		chug_sram_release(CH_SRAM_REGION_ACCUMULATOR);
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_TAKE_READING_SPECTRAL, rc);
+		_dark_pending = FALSE;
+		_spectral_pending = FALSE;
+		_spectral_xyz_pending = FALSE;
+		return;
+	}
+
+	/* nothing new has been stored */
+	sequence = oo_elis1024_get_sequence(&_elis1024_ctx);
+	if (sequence == _spectral_sequence)
+		return;
+	_spectral_sequence = sequence;
+
+	/* the dark frame is now usable */
+	if (_dark_pending) {
+		_dark_pending = FALSE;
+		_dark_valid = TRUE;
+	}
+
+	/* save what was used, e.g. the chosen integration time */
+	if (_spectral_pending) {
+		if (!_elis1024_ctx.continuous)
+			_spectral_pending = FALSE;
+		/* before smoothing, so the stream shows when it was read out */
+		_spectral_timestamp = chug_timer_get_ms();
+		_spectral_offset = _elis1024_ctx.offset;
+		oo_elis1024_get_header(&_elis1024_ctx, &_spectral_header);
+		oo_elis1024_get_stats(&_elis1024_ctx, &_spectral_stats);
+		if (_spectral_smooth > 0) {
+			start_us = chug_timer_get_us();
+			chug_spectral_smooth(_spectral_offset,
+					     _spectral_header.pixel_count,
+					     _spectral_smooth);
+			_spectral_smooth_time = chug_timer_get_us() - start_us;
+			if (_spectral_smooth == 5)
+				_spectral_header.flags |= CH_SPECTRAL_FLAG_SMOOTH_5;
+			else
+				_spectral_header.flags |= CH_SPECTRAL_FLAG_SMOOTH_9;
+		}
+		if (_spectral_resample) {
+			rc = chug_resample_spectrum();
+			if (rc != CH_ERROR_NONE)
+				chug_set_error(CH_CMD_TAKE_READING_SPECTRAL, rc);
+			else
+				_spectral_header.flags |= CH_SPECTRAL_FLAG_RESAMPLE;
+		}
+	}
+
+	/* get Q24.8 readings in the same units as the spectrum */
+	if (_spectral_xyz_pending && !_spectral_pending) {
+		chug_spectral_get_xyz(_spectral_xyz);
+		_spectral_xyz_pending = FALSE;
+		_spectral_xyz_valid = TRUE;
+	}
+}
+
+/* Fletcher-16 of the record data */
+static uint16_t
+chug_calibration_checksum(const uint8_t *data, uint16_t len)
+{
+	uint16_t sum1 = 0;
+	uint16_t sum2 = 0;
+	uint16_t i;
+
+	for (i = 0; i < len; i++) {
+		sum1 += data[i];
+		if (sum1 >= 255)
+			sum1 -= 255;
+		sum2 += sum1;
+		if (sum2 >= 255)
+			sum2 -= 255;
+	}
+	return (sum2 << 8) | sum1;
+}
+
+/* returns the length of the data, or 0 if there is no valid record */
+static uint16_t
+chug_calibration_read(uint16_t addr, uint16_t magic, uint8_t *data, uint16_t max)
+{
+	ChCalibrationHeader hdr;
+
+	chug_flash_read(addr, (uint8_t *) &hdr, sizeof(hdr));
+	if (hdr.magic != magic || hdr.len > max)
+		return 0;
+	chug_flash_read(addr + sizeof(hdr), data, hdr.len);
+	if (chug_calibration_checksum(data, hdr.len) != hdr.checksum)
+		return 0;
+	return hdr.len;
+}
+
+/* the record is staged in _chug_buf as flash is written in whole blocks */
+static ChError
+chug_calibration_write(uint16_t addr, uint16_t magic,
+		       const uint8_t *data, uint16_t len)
+{
+	ChCalibrationHeader *hdr = (ChCalibrationHeader *) _chug_buf;
+
+	hdr->magic = magic;
+	hdr->len = len;
+	hdr->checksum = chug_calibration_checksum(data, len);
+	memcpy(_chug_buf + sizeof(ChCalibrationHeader), data, len);
+	return chug_flash_write(addr, _chug_buf,
+				sizeof(ChCalibrationHeader) + len);
+}
+
+/* no valid record means no hot pixels */
+static void
+chug_hot_pixels_load(void)
+{
+	uint16_t len;
+
+	len = chug_calibration_read(CH_HOT_PIXELS_ADDRESS_WRDS,
+				    CH_HOT_PIXELS_MAGIC,
+				    (uint8_t *) _hot_pixels,
+				    sizeof(_hot_pixels));
+	_hot_pixel_count = len / sizeof(uint16_t);
+	oo_elis1024_set_hot_pixels(&_elis1024_ctx, _hot_pixels,
+				   _hot_pixel_count);
+}
+
+/* no valid record, or one of the wrong size, means no table */
+static void
+chug_linearity_load(void)
+{
+	uint16_t len;
+
+	len = chug_calibration_read(CH_LINEARITY_ADDRESS_WRDS,
+				    CH_LINEARITY_MAGIC,
+				    (uint8_t *) _linearity,
+				    sizeof(_linearity));
+	_linearity_valid = len == sizeof(_linearity);
+	oo_elis1024_set_linearity(&_elis1024_ctx,
+				  _linearity_valid ? _linearity : NULL);
+}
+
+/* the hot pixels and linearity table share an erase block, so both are
+ * written back from RAM whenever either changes */
+static ChError
+chug_calibration_save(void)
+{
+	ChError rc;
+
+	rc = chug_flash_erase(CH_CALIBRATION_ADDRESS_WRDS,
+			      CH_FLASH_ERASE_BLOCK_SIZE);
+	if (rc != CH_ERROR_NONE)
+		goto out;
+	if (_hot_pixel_count > 0) {
+		rc = chug_calibration_write(CH_HOT_PIXELS_ADDRESS_WRDS,
+					    CH_HOT_PIXELS_MAGIC,
+					    (const uint8_t *) _hot_pixels,
+					    _hot_pixel_count * sizeof(uint16_t));
+		if (rc != CH_ERROR_NONE)
+			goto out;
+	}
+	if (_linearity_valid) {
+		rc = chug_calibration_write(CH_LINEARITY_ADDRESS_WRDS,
+					    CH_LINEARITY_MAGIC,
+					    (const uint8_t *) _linearity,
+					    sizeof(_linearity));
+		if (rc != CH_ERROR_NONE)
+			goto out;
+	}
+out:
+	chug_hot_pixels_load();
+	chug_linearity_load();
+	return rc;
+}
+
+static int32_t
+chug_dark_get_temperature(void)
+{
+	int32_t tmp = 0;
+#ifdef HAVE_TCN75A
+	mti_tcn75a_get_temperature(&tmp);
+#endif
+	return tmp;
+}
+
+static void
+chug_dark_check_valid(void)
+{
+	int32_t drift;
+
+	/* integration time has changed */
+	if (_dark_integration_time != _integration_time) {
+		_dark_valid = FALSE;
+		return;
+	}
+
+	/* pixel window or binning has changed */
+	if (_dark_pixel_start != _elis1024_ctx.pixel_start ||
+	    _dark_pixel_length != _elis1024_ctx.pixel_length ||
+	    _dark_binning != _elis1024_ctx.binning) {
+		_dark_valid = FALSE;
+		return;
+	}
+
+	/* temperature has drifted */
+	drift = chug_dark_get_temperature() - _dark_temperature;
+	if (drift > CH_DARK_TEMPERATURE_DRIFT ||
+	    drift < -CH_DARK_TEMPERATURE_DRIFT)
+		_dark_valid = FALSE;
+}
+
+/*
+ * Starts a reading into the spectrum area of the SRAM using the current
+ * spectral flags. This returns before the reading is complete, and with
+ * auto-exposure the integration time is the longest allowed.
+ *
+ * When @continuous is set single frames are acquired back to back until
+ * chug_stream_stop() is called, each one being processed as it is stored.
+ */
+static ChError
+chug_spectral_start(uint16_t frames, uint8_t continuous)
+{
+	ChError rc;
+	uint8_t dark_subtract = FALSE;
+	uint8_t resample = FALSE;
+	uint8_t smooth = 0;
+
+	/* the dark frame would not match the chosen integration time */
+	if ((_spectral_flags & CH_SPECTRAL_FLAG_DARK_SUBTRACT) &&
+	    (_spectral_flags & CH_SPECTRAL_FLAG_AUTO_EXPOSURE))
+		return CH_ERROR_INVALID_VALUE;
+
+	/* only use a dark frame that is still valid */
+	if (_spectral_flags & CH_SPECTRAL_FLAG_DARK_SUBTRACT) {
+		chug_dark_check_valid();
+		if (!_dark_valid)
+			return CH_ERROR_NO_CALIBRATION;
+		dark_subtract = TRUE;
+	}
+
+	/* resampling needs the wavelength to increase with pixel index */
+	if (_spectral_flags & CH_SPECTRAL_FLAG_RESAMPLE) {
+		if (_cfg.wavelength_cal[1] <= 0)
+			return CH_ERROR_NO_CALIBRATION;
+		resample = TRUE;
+	}
+
+	/* only one smoothing filter can be used */
+	if (_spectral_flags & CH_SPECTRAL_FLAG_SMOOTH_5)
+		smooth = 5;
+	if (_spectral_flags & CH_SPECTRAL_FLAG_SMOOTH_9) {
+		if (smooth > 0)
+			return CH_ERROR_INVALID_VALUE;
+		smooth = 9;
+	}
+
+	rc = chug_spectral_claim_accumulator(continuous ? 1 : frames);
+	if (rc != CH_ERROR_NONE)
+		return rc;
+
+	chug_set_leds(0);
+	oo_elis1024_set_dark_subtract(&_elis1024_ctx, dark_subtract);
+	oo_elis1024_set_auto_exposure(&_elis1024_ctx,
+				      _spectral_flags & CH_SPECTRAL_FLAG_AUTO_EXPOSURE);
+	if (continuous) {
+		rc = oo_elis1024_start_continuous(&_elis1024_ctx,
+						  _integration_time,
+						  CH_SRAM_OFFSET(CH_SRAM_REGION_SPECTRUM));
+	} else {
+		rc = oo_elis1024_start_sample(&_elis1024_ctx,
+					      _integration_time,
+					      frames,
+					      CH_SRAM_OFFSET(CH_SRAM_REGION_SPECTRUM));
+	}
+	if (rc != CH_ERROR_NONE)
+		return rc;
+	_spectral_resample = resample;
+	_spectral_smooth = smooth;
+	_spectral_pending = TRUE;
+	_spectral_xyz_pending = FALSE;
+	_spectral_xyz_valid = FALSE;
+	return CH_ERROR_NONE;
+}
+
+/* prepares the frame just acquired to be sent with a header */
+static void
+chug_stream_frame_init(void)
+{
+	_stream_header.sequence = _stream_sequence - _stream_sequence_start - 1;
+	_stream_header.timestamp = _spectral_timestamp;
+	memcpy(&_stream_header.header, &_spectral_header, sizeof(ChSpectralHeader));
+	if (_spectral_header.flags & CH_SPECTRAL_FLAG_RESAMPLE) {
+		_stream_addr = CH_SRAM_OFFSET(CH_SRAM_REGION_RESAMPLED);
+		_stream_header.count = _resample_count;
+	} else {
+		_stream_addr = _spectral_offset;
+		_stream_header.count = _spectral_header.pixel_count;
+	}
+
+	/* store the next frames in the other slot while this one is sent */
+	if (_stream_pipelined) {
+		if (_spectral_offset == CH_SRAM_OFFSET(CH_SRAM_REGION_SPECTRUM))
+			oo_elis1024_set_offset(&_elis1024_ctx,
+					       CH_SRAM_OFFSET(CH_SRAM_REGION_SPECTRUM_ALT));
+		else
+			oo_elis1024_set_offset(&_elis1024_ctx,
+					       CH_SRAM_OFFSET(CH_SRAM_REGION_SPECTRUM));
+	}
+	_stream_len = sizeof(ChSpectralStreamHeader) +
+		      _stream_header.count * sizeof(uint16_t);
+	_stream_sent = 0;
+
+	/* the host needs a short packet to know the transfer has ended */
+	_stream_zlp = (_stream_len % EP_1_IN_LEN) == 0;
+}
+
+/* stops streaming, discarding any frame being acquired or sent */
+static void
+chug_stream_stop(void)
+{
+	if (_stream_pipelined) {
+		oo_elis1024_stop(&_elis1024_ctx);
+		chug_sram_release(CH_SRAM_REGION_SPECTRUM_ALT);
+		_spectral_pending = FALSE;
+		_stream_pipelined = FALSE;
+	}
+	_stream_state = CH_STREAM_STATE_IDLE;
+
+	/* a packet still being read from the SRAM is not sent */
+	mti_23k640_dma_flush();
+}
+
+/* the packet has been read from the SRAM, so it can be sent */
+static void
+chug_stream_dma_cb(void *user_data)
+{
+	_stream_dma_busy = FALSE;
+	if (_stream_state != CH_STREAM_STATE_SENDING)
+		return;
+	usb_send_in_buffer(1, _stream_dma_len);
+	_stream_sent += _stream_dma_len;
+}
+
+/*
+ * Sends the next packet of the current frame when EP1 is free, and starts
+ * acquiring the next frame once the last packet has been queued.
+ *
+ * When pipelined, the sensor never stops and frames alternate between two
+ * SRAM slots. The slot not being sent is always the one written to, so if
+ * the host is slower than the sensor the older frames are dropped, which
+ * the host can see as gaps in the sequence number.
+ */
+static void
+chug_stream_poll(void)
+{
+	ChError rc;
+	uint8_t *buf;
+	uint16_t len;
+	uint16_t hdr_len = 0;
+
+	switch (_stream_state) {
+	case CH_STREAM_STATE_ACQUIRING:
+		/* nothing new, or the reading failed */
+		if (_spectral_sequence == _stream_sequence) {
+			if (!_spectral_pending)
+				chug_stream_stop();
+			return;
+		}
+		_stream_sequence = _spectral_sequence;
+		chug_stream_frame_init();
+		_stream_state = CH_STREAM_STATE_SENDING;
+		break;
+	case CH_STREAM_STATE_SENDING:
+		/* the last packet is still being read */
+		if (_stream_dma_busy)
+			return;
+		break;
+	default:
+		return;
+	}
+
+	if (!usb_is_configured() ||
+	    usb_in_endpoint_halted(1) ||
+	    usb_in_endpoint_busy(1))
+		return;
+
+	/* all sent, so get the next frame */
+	if (_stream_sent == _stream_len) {
+		if (_stream_zlp) {
+			usb_send_in_buffer(1, 0);
+			_stream_zlp = FALSE;
+			return;
+		}
+		if (!_stream_pipelined) {
+			rc = chug_spectral_start(_stream_frames, FALSE);
+			if (rc != CH_ERROR_NONE) {
+				chug_set_error(CH_CMD_START_STREAMING, rc);
+				_stream_state = CH_STREAM_STATE_IDLE;
+				return;
+			}
+		}
+		_stream_state = CH_STREAM_STATE_ACQUIRING;
+		return;
+	}
+
+	/* the header is always in the first packet */
+	buf = usb_get_in_buffer(1);
+	len = _stream_len - _stream_sent;
+	if (len > EP_1_IN_LEN)
+		len = EP_1_IN_LEN;
+	if (_stream_sent == 0) {
+		hdr_len = sizeof(ChSpectralStreamHeader);
+		memcpy(buf, &_stream_header, hdr_len);
+	}
+
+	/* the packet is sent from the DMA callback, so USB and the sensor
+	 * are serviced while the SRAM is being read */
+	if (mti_23k640_dma_queue_to_cpu(_stream_addr + _stream_sent + hdr_len -
+					sizeof(ChSpectralStreamHeader),
+					buf + hdr_len, len - hdr_len,
+					chug_stream_dma_cb, NULL) != 0)
+		return;
+	_stream_dma_len = len;
+	_stream_dma_busy = TRUE;
+}
+#endif
+
+#ifdef HAVE_SRAM
+/* returns TRUE if EP1 is still being used for a READ_SRAM_BULK range */
+static uint8_t
+chug_sram_bulk_is_active(void)
+{
+	return _sram_bulk_sent != _sram_bulk_len || _sram_bulk_zlp;
+}
+
+/* stops sending or receiving, discarding the rest of the range */
+static void
+chug_sram_bulk_stop(void)
+{
+	/* some of the range may already have been written */
+	if (_sram_bulk_write)
+		chug_sram_changed(_sram_bulk_addr, _sram_bulk_len);
+	_sram_bulk_write = FALSE;
+	_sram_bulk_len = 0;
+	_sram_bulk_sent = 0;
+	_sram_bulk_zlp = FALSE;
+
+	/* a packet still being read from the SRAM is not sent */
+	mti_23k640_dma_flush();
+}
+
+/* the packet has been read from the SRAM, so it can be sent */
+static void
+chug_sram_bulk_dma_cb(void *user_data)
+{
+	_sram_bulk_dma_busy = FALSE;
+	if (!chug_sram_bulk_is_active())
+		return;
+	usb_send_in_buffer(1, _sram_bulk_dma_len);
+	_sram_bulk_sent += _sram_bulk_dma_len;
+}
+
+/* the packet has been written to the SRAM, so the buffer can be reused */
+static void
+chug_sram_bulk_write_dma_cb(void *user_data)
+{
+	_sram_bulk_dma_busy = FALSE;
+	if (!chug_sram_bulk_is_active())
+		return;
+	_sram_bulk_sent += _sram_bulk_dma_len;
+	usb_arm_out_endpoint(1);
+	if (_sram_bulk_sent == _sram_bulk_len) {
+		_sram_bulk_write = FALSE;
+		chug_sram_changed(_sram_bulk_addr, _sram_bulk_len);
+	}
+}
+
+/*
+ * Writes the next packet of the WRITE_SRAM_BULK range when one has been
+ * received on EP1. Packets that were not asked for are dropped, so the
+ * endpoint is never left waiting for a range that will not come.
+ */
+static void
+chug_sram_bulk_write_poll(void)
+{
+	const unsigned char *buf;
+	uint8_t len;
+
+	if (_sram_bulk_dma_busy)
+		return;
+	if (!usb_is_configured() ||
+	    usb_out_endpoint_halted(1) ||
+	    !usb_out_endpoint_has_data(1))
+		return;
+	len = usb_get_out_buffer(1, &buf);
+	if (!_sram_bulk_write || len == 0) {
+		usb_arm_out_endpoint(1);
+		return;
+	}
+
+	/* the host has sent more than the range */
+	if (len > _sram_bulk_len - _sram_bulk_sent) {
+		chug_set_error(CH_CMD_WRITE_SRAM_BULK, CH_ERROR_INVALID_LENGTH);
+		chug_sram_bulk_stop();
+		usb_arm_out_endpoint(1);
+		return;
+	}
+	if (mti_23k640_dma_queue_from_cpu(buf,
+					  _sram_bulk_addr + _sram_bulk_sent,
+					  len,
+					  chug_sram_bulk_write_dma_cb,
+					  NULL) != 0)
+		return;
+	_sram_bulk_dma_len = len;
+	_sram_bulk_dma_busy = TRUE;
+}
+
+/*
+ * Sends the next packet of the READ_SRAM_BULK range when EP1 is free.
+ *
+ * EP1 is ping-pong buffered, so the next packet is read from the SRAM into
+ * one buffer while the other is on the bus, and the range is not limited
+ * by the size of _chug_buf.
+ */
+static void
+chug_sram_bulk_poll(void)
+{
+	uint16_t len;
+
+	chug_sram_bulk_write_poll();
+	if (_sram_bulk_write)
+		return;
+	if (!chug_sram_bulk_is_active() || _sram_bulk_dma_busy)
+		return;
+	if (!usb_is_configured() ||
+	    usb_in_endpoint_halted(1) ||
+	    usb_in_endpoint_busy(1))
+		return;
+
+	/* the host needs a short packet to know the transfer has ended */
+	if (_sram_bulk_sent == _sram_bulk_len) {
+		usb_send_in_buffer(1, 0);
+		_sram_bulk_zlp = FALSE;
+		return;
+	}
+
+	len = _sram_bulk_len - _sram_bulk_sent;
+	if (len > EP_1_IN_LEN)
+		len = EP_1_IN_LEN;
+	if (mti_23k640_dma_queue_to_cpu(_sram_bulk_addr + _sram_bulk_sent,
+					usb_get_in_buffer(1), len,
+					chug_sram_bulk_dma_cb, NULL) != 0)
+		return;
+	_sram_bulk_dma_len = len;
+	_sram_bulk_dma_busy = TRUE;
+}
+#endif
+
 #define HAVE_TESTS
 
 int
@@ -202,6 +1142,9 @@ main(void)
 {
 	uint8_t dfu_interfaces[] = { 0x01 };
 
+	/* used for timing acquisitions and showing errors */
+	chug_timer_init();
+
 #ifdef HAVE_TCN75A
 	/* set up TCN75A */
 	SSP1ADD = 0x3e;
@@ -228,7 +1171,8 @@ main(void)
 	DMACON2bits.DLYCYC = 0x02;	/* minimum delay between bytes */
 
 	/* populate the SRAM from saved eeprom */
-	chug_flash_load_sram(CH_SRAM_ADDRESS_WRDS, 0x2000);
+	chug_flash_load_sram(CH_SRAM_ADDRESS_WRDS,
+			     chug_sram_get_region(CH_SRAM_REGION_SHADOW)->size);
 #endif
 
 #ifdef HAVE_ELIS1024
@@ -237,8 +1181,8 @@ main(void)
 	ADCON0bits.VCFG0 = 0;		/* reference is VDD, no hardware VRef+ */
 	ADCON0bits.CHS = 0b0000;	/* input (AN0) */
 	ADCON0bits.ADON = 1;		/* enable module */
-	ADCON1bits.ACQT = 0b111;	/* A/D Acquisition Time Select (FIXME: can we disable this?) */
-	ADCON1bits.ADCS = 0b010;	/* A/D Conversion Clock Select (Fosc/32) */
+	ADCON1bits.ACQT = 0b111;	/* A/D Acquisition Time Select (set per readout profile) */
+	ADCON1bits.ADCS = 0b010;	/* A/D Conversion Clock Select (set per readout profile) */
 	ANCON1bits.VBGEN = 0;		/* enable band gap reference */
 	ANCON0bits.PCFG0 = 0;		/* AN0 = analog */
 
@@ -249,6 +1193,13 @@ main(void)
 	ADCON1bits.ADCAL = 0;
 
 	/* power down sensor */
+	oo_elis1024_init(&_elis1024_ctx);
+	oo_elis1024_set_accumulator(&_elis1024_ctx,
+				    CH_SRAM_OFFSET(CH_SRAM_REGION_ACCUMULATOR));
+	oo_elis1024_set_dark(&_elis1024_ctx,
+			     CH_SRAM_OFFSET(CH_SRAM_REGION_DARK));
+	chug_hot_pixels_load();
+	chug_linearity_load();
 	oo_elis1024_set_standby();
 #endif
 
@@ -281,6 +1232,17 @@ main(void)
 		/* clear watchdog */
 		CLRWDT();
 		usb_service();
+
+		/* keep the ms counter current between readings */
+		chug_timer_get_ms();
+#ifdef HAVE_SRAM
+		mti_23k640_dma_poll();
+		chug_sram_bulk_poll();
+#endif
+#ifdef HAVE_ELIS1024
+		chug_spectral_poll();
+		chug_stream_poll();
+#endif
 		chug_heatbeat(CH_STATUS_LED_RED);
 	}
 
@@ -316,6 +1278,10 @@ chug_handle_read_sram(const struct setup_packet *setup)
 		chug_set_error(CH_CMD_READ_SRAM, CH_ERROR_INVALID_LENGTH);
 		return -1;
 	}
+	if (setup->wValue > CH_SRAM_SIZE - setup->wLength) {
+		chug_set_error(CH_CMD_READ_SRAM, CH_ERROR_INVALID_ADDRESS);
+		return -1;
+	}
 	mti_23k640_dma_to_cpu(setup->wValue, _chug_buf, setup->wLength);
 	mti_23k640_dma_wait();
 #else
@@ -325,6 +1291,159 @@ chug_handle_read_sram(const struct setup_packet *setup)
 	return 0;
 }
 
+#ifdef HAVE_SRAM
+static uint32_t _sram_crc = 0;
+static uint8_t _sram_crc_valid = FALSE;
+
+/* checks the range is inside the SRAM before calling */
+static uint32_t
+chug_sram_crc(uint16_t addr, uint16_t len)
+{
+	const uint16_t half = sizeof(_chug_buf) / 2;
+	uint16_t chunk = half;
+	uint16_t next;
+	uint32_t crc = 0;
+	uint8_t *buf = _chug_buf;
+	uint8_t *other;
+
+	if (len > 0) {
+		if (chunk > len)
+			chunk = len;
+		mti_23k640_dma_to_cpu(addr, buf, chunk);
+		mti_23k640_dma_wait();
+	}
+
+	/* read the next chunk into the other half of _chug_buf while the
+	 * last one is being checked */
+	while (len > 0) {
+		CLRWDT();
+		addr += chunk;
+		len -= chunk;
+		next = len;
+		if (next > half)
+			next = half;
+		other = buf == _chug_buf ? _chug_buf + half : _chug_buf;
+		if (next > 0 &&
+		    mti_23k640_dma_queue_to_cpu(addr, other, next,
+						NULL, NULL) != 0) {
+			/* the queue is full, so just read it now */
+			mti_23k640_dma_to_cpu(addr, other, next);
+			mti_23k640_dma_wait();
+		}
+		crc = chug_crc32(crc, buf, chunk);
+		mti_23k640_dma_flush();
+		buf = other;
+		chunk = next;
+	}
+	return crc;
+}
+
+static int8_t
+_recieve_calculate_sram_crc_cb(bool transfer_ok, void *context)
+{
+	uint16_t *buf = (uint16_t *) _chug_buf;
+
+	/* error */
+	if (!transfer_ok) {
+		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
+		return -1;
+	}
+
+	/* addr, length */
+	_sram_crc_valid = FALSE;
+	if (buf[0] >= CH_SRAM_SIZE || buf[1] > CH_SRAM_SIZE - buf[0]) {
+		chug_set_error(CH_CMD_CALCULATE_SRAM_CRC,
+			       CH_ERROR_INVALID_ADDRESS);
+		return -1;
+	}
+	_sram_crc = chug_sram_crc(buf[0], buf[1]);
+	_sram_crc_valid = TRUE;
+	return 0;
+}
+#endif
+
+static int8_t
+chug_handle_calculate_sram_crc(const struct setup_packet *setup)
+{
+#ifdef HAVE_SRAM
+	/* the range is sent rather than using wLength, as WinUSB limits
+	 * control transfers to 4k, and GET_SRAM_CRC gets the result */
+	if (setup->wLength != sizeof(uint16_t) * 2) {
+		chug_set_error(CH_CMD_CALCULATE_SRAM_CRC, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
+					 _recieve_calculate_sram_crc_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_CALCULATE_SRAM_CRC, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+static int8_t
+chug_handle_get_sram_crc(const struct setup_packet *setup)
+{
+#ifdef HAVE_SRAM
+	if (setup->wLength != sizeof(uint32_t)) {
+		chug_set_error(CH_CMD_GET_SRAM_CRC, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+
+	/* no CALCULATE_SRAM_CRC, or the range was invalid */
+	if (!_sram_crc_valid) {
+		chug_set_error(CH_CMD_GET_SRAM_CRC, CH_ERROR_INCOMPLETE_REQUEST);
+		return -1;
+	}
+	memcpy(_chug_buf, &_sram_crc, sizeof(uint32_t));
+	usb_send_data_stage(_chug_buf, sizeof(uint32_t),
+			    _send_data_stage_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_GET_SRAM_CRC, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+static int8_t
+chug_handle_read_sram_encoded(const struct setup_packet *setup)
+{
+	uint16_t addr = setup->wValue & 0x1fff;
+	uint16_t len = setup->wLength;
+	uint8_t encoding = setup->wValue >> 13;
+
+	/* wLength is the number of raw bytes to encode */
+	if (len > sizeof(_chug_buf) || (len & 1) || addr + len > CH_SRAM_SIZE) {
+		chug_set_error(CH_CMD_READ_SRAM_ENCODED, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+#ifdef HAVE_SRAM
+	mti_23k640_dma_to_cpu(addr, _chug_buf, len);
+	mti_23k640_dma_wait();
+#else
+	memset(_chug_buf, 0x00, len);
+#endif
+
+	/* the data is sent raw when it cannot be encoded, and the encoded
+	 * reply is always shorter, so the host can use the length of the
+	 * transfer */
+	switch (encoding) {
+	case CH_SRAM_ENCODING_RAW:
+		break;
+	case CH_SRAM_ENCODING_PACKED12:
+		len = chug_encode_packed12(_chug_buf, len);
+		break;
+	case CH_SRAM_ENCODING_DELTA:
+		len = chug_encode_delta(_chug_buf, len);
+		break;
+	default:
+		chug_set_error(CH_CMD_READ_SRAM_ENCODED, CH_ERROR_INVALID_VALUE);
+		return -1;
+	}
+	usb_send_data_stage(_chug_buf, len, _send_data_stage_cb, NULL);
+	return 0;
+}
+
 static uint16_t _write_sram_addr;
 static uint16_t _write_sram_len;
 
@@ -336,56 +1455,571 @@ _recieve_data_sram_cb(bool transfer_ok, void *context)
 		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
 		return -1;
 	}
-#ifdef HAVE_SRAM
-	mti_23k640_dma_from_cpu(_chug_buf, _write_sram_addr, _write_sram_len);
-	mti_23k640_dma_wait();
-#endif
+#ifdef HAVE_SRAM
+	mti_23k640_dma_from_cpu(_chug_buf, _write_sram_addr, _write_sram_len);
+	mti_23k640_dma_wait();
+#endif
+	chug_sram_changed(_write_sram_addr, _write_sram_len);
+	return 0;
+}
+
+static int8_t
+chug_handle_write_sram(const struct setup_packet *setup)
+{
+	/* check size, as larger ranges are sent with WRITE_SRAM_BULK */
+	if (setup->wLength > sizeof(_chug_buf)) {
+		chug_set_error(CH_CMD_WRITE_SRAM, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+	if (setup->wValue > CH_SRAM_SIZE - setup->wLength) {
+		chug_set_error(CH_CMD_WRITE_SRAM, CH_ERROR_INVALID_ADDRESS);
+		return -1;
+	}
+
+	/* receive data */
+	_write_sram_addr = setup->wValue;
+	_write_sram_len = setup->wLength;
+	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
+					 _recieve_data_sram_cb, NULL);
+	return 0;
+}
+
+#ifdef HAVE_SRAM
+static int8_t
+_recieve_read_sram_bulk_cb(bool transfer_ok, void *context)
+{
+	uint16_t len;
+
+	/* error */
+	if (!transfer_ok) {
+		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
+		return -1;
+	}
+
+	/* the number of bytes to send, which can cover the whole SRAM */
+	memcpy(&len, _chug_buf, sizeof(uint16_t));
+	if (len == 0 || len > CH_SRAM_SIZE - _sram_bulk_addr) {
+		chug_set_error(CH_CMD_READ_SRAM_BULK, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+	_sram_bulk_len = len;
+	_sram_bulk_sent = 0;
+	_sram_bulk_zlp = (len % EP_1_IN_LEN) == 0;
+	return 0;
+}
+#endif
+
+static int8_t
+chug_handle_read_sram_bulk(const struct setup_packet *setup)
+{
+#ifdef HAVE_SRAM
+	/* EP1 is also used for streaming spectra */
+	if (chug_sram_bulk_is_active()) {
+		chug_set_error(CH_CMD_READ_SRAM_BULK, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+#ifdef HAVE_ELIS1024
+	if (_stream_state != CH_STREAM_STATE_IDLE) {
+		chug_set_error(CH_CMD_READ_SRAM_BULK, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+#endif
+	if (setup->wLength != sizeof(uint16_t)) {
+		chug_set_error(CH_CMD_READ_SRAM_BULK, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+	if (setup->wValue >= CH_SRAM_SIZE) {
+		chug_set_error(CH_CMD_READ_SRAM_BULK, CH_ERROR_INVALID_ADDRESS);
+		return -1;
+	}
+
+	/* wValue is the SRAM address, and the data is sent on EP1 */
+	_sram_bulk_addr = setup->wValue;
+	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
+					 _recieve_read_sram_bulk_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_READ_SRAM_BULK, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+#ifdef HAVE_SRAM
+static int8_t
+_recieve_write_sram_bulk_cb(bool transfer_ok, void *context)
+{
+	uint16_t len;
+
+	/* error */
+	if (!transfer_ok) {
+		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
+		return -1;
+	}
+
+	/* the number of bytes to receive, which can cover the whole SRAM */
+	memcpy(&len, _chug_buf, sizeof(uint16_t));
+	if (len == 0 || len > CH_SRAM_SIZE - _sram_bulk_addr) {
+		chug_set_error(CH_CMD_WRITE_SRAM_BULK, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+	_sram_bulk_len = len;
+	_sram_bulk_sent = 0;
+	_sram_bulk_zlp = FALSE;
+	_sram_bulk_write = TRUE;
+	return 0;
+}
+#endif
+
+static int8_t
+chug_handle_write_sram_bulk(const struct setup_packet *setup)
+{
+#ifdef HAVE_SRAM
+	/* one range at a time, and never while streaming */
+	if (chug_sram_bulk_is_active()) {
+		chug_set_error(CH_CMD_WRITE_SRAM_BULK, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+#ifdef HAVE_ELIS1024
+	if (_stream_state != CH_STREAM_STATE_IDLE) {
+		chug_set_error(CH_CMD_WRITE_SRAM_BULK, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+#endif
+	if (setup->wLength != sizeof(uint16_t)) {
+		chug_set_error(CH_CMD_WRITE_SRAM_BULK, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+	if (setup->wValue >= CH_SRAM_SIZE) {
+		chug_set_error(CH_CMD_WRITE_SRAM_BULK, CH_ERROR_INVALID_ADDRESS);
+		return -1;
+	}
+
+	/* wValue is the SRAM address, and the data is received on EP1 */
+	_sram_bulk_addr = setup->wValue;
+	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
+					 _recieve_write_sram_bulk_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_WRITE_SRAM_BULK, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+#ifdef HAVE_SRAM
+static uint8_t _fill_sram_value;
+
+static int8_t
+_recieve_fill_sram_cb(bool transfer_ok, void *context)
+{
+	uint16_t *buf = (uint16_t *) _chug_buf;
+
+	/* error */
+	if (!transfer_ok) {
+		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
+		return -1;
+	}
+
+	/* addr, length */
+	if (buf[0] >= CH_SRAM_SIZE || buf[1] > CH_SRAM_SIZE - buf[0]) {
+		chug_set_error(CH_CMD_FILL_SRAM, CH_ERROR_INVALID_ADDRESS);
+		return -1;
+	}
+	mti_23k640_fill(buf[0], _fill_sram_value, buf[1]);
+	chug_sram_changed(buf[0], buf[1]);
+	return 0;
+}
+#endif
+
+static int8_t
+chug_handle_fill_sram(const struct setup_packet *setup)
+{
+#ifdef HAVE_SRAM
+	/* check size */
+	if (setup->wLength != sizeof(uint16_t) * 2) {
+		chug_set_error(CH_CMD_FILL_SRAM, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+
+	/* wValue is the byte to write */
+	_fill_sram_value = setup->wValue & 0xff;
+	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
+					 _recieve_fill_sram_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_FILL_SRAM, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+#ifdef HAVE_SRAM
+static int8_t
+_recieve_copy_sram_cb(bool transfer_ok, void *context)
+{
+	uint16_t *buf = (uint16_t *) _chug_buf;
+	uint16_t dest;
+	uint16_t src;
+	uint16_t len;
+
+	/* error */
+	if (!transfer_ok) {
+		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
+		return -1;
+	}
+
+	/* dest, src, length, which may overlap */
+	dest = buf[0];
+	src = buf[1];
+	len = buf[2];
+	if (dest >= CH_SRAM_SIZE || len > CH_SRAM_SIZE - dest ||
+	    src >= CH_SRAM_SIZE || len > CH_SRAM_SIZE - src) {
+		chug_set_error(CH_CMD_COPY_SRAM, CH_ERROR_INVALID_ADDRESS);
+		return -1;
+	}
+
+	/* the arguments have been copied out, so use all of _chug_buf */
+	mti_23k640_move(dest, src, len, _chug_buf, sizeof(_chug_buf));
+	chug_sram_changed(dest, len);
+	return 0;
+}
+#endif
+
+static int8_t
+chug_handle_copy_sram(const struct setup_packet *setup)
+{
+#ifdef HAVE_SRAM
+	/* check size */
+	if (setup->wLength != sizeof(uint16_t) * 3) {
+		chug_set_error(CH_CMD_COPY_SRAM, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
+					 _recieve_copy_sram_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_COPY_SRAM, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+static int8_t
+_recieve_spectral_calibration_cb(bool transfer_ok, void *context)
+{
+	/* error */
+	if (!transfer_ok) {
+		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
+		return -1;
+	}
+
+	/* save to EEPROM */
+	memcpy(_cfg.wavelength_cal, _chug_buf, sizeof(int32_t) * 4);
+	chug_config_write(&_cfg);
+#ifdef HAVE_ELIS1024
+	_resample_index_valid = FALSE;
+#endif
+	return 0;
+}
+
+static int8_t
+chug_handle_set_wavelength_calibration(const struct setup_packet *setup)
+{
+	/* check size */
+	if (setup->wLength != sizeof(int32_t) * 4) {
+		chug_set_error(CH_CMD_SET_CCD_CALIBRATION, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
+					 _recieve_spectral_calibration_cb, NULL);
+	return 0;
+}
+
+#ifdef HAVE_ELIS1024
+static int8_t
+_recieve_pixel_window_cb(bool transfer_ok, void *context)
+{
+	uint8_t rc;
+	uint16_t *buf = (uint16_t *) _chug_buf;
+
+	/* error */
+	if (!transfer_ok) {
+		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
+		return -1;
+	}
+
+	/* start, length */
+	rc = oo_elis1024_set_window(&_elis1024_ctx, buf[0], buf[1]);
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_SET_PIXEL_WINDOW, rc);
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+static int8_t
+chug_handle_set_pixel_window(const struct setup_packet *setup)
+{
+#ifdef HAVE_ELIS1024
+	/* check size */
+	if (setup->wLength != sizeof(uint16_t) * 2) {
+		chug_set_error(CH_CMD_SET_PIXEL_WINDOW, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
+					 _recieve_pixel_window_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_SET_PIXEL_WINDOW, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+#ifdef HAVE_ELIS1024
+static int8_t
+_recieve_resample_grid_cb(bool transfer_ok, void *context)
+{
+	uint16_t *buf = (uint16_t *) _chug_buf;
+
+	/* error */
+	if (!transfer_ok) {
+		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
+		return -1;
+	}
+
+	/* start, step, count, all in nm */
+	if (buf[1] == 0 ||
+	    buf[2] == 0 ||
+	    buf[2] > CH_RESAMPLE_POINTS_MAX ||
+	    buf[0] + (uint32_t) buf[1] * (buf[2] - 1) >= 0x8000) {
+		chug_set_error(CH_CMD_SET_RESAMPLE_GRID, CH_ERROR_INVALID_VALUE);
+		return -1;
+	}
+	_resample_start = buf[0];
+	_resample_step = buf[1];
+	_resample_count = buf[2];
+	_resample_index_valid = FALSE;
+	return 0;
+}
+#endif
+
+static int8_t
+chug_handle_set_resample_grid(const struct setup_packet *setup)
+{
+#ifdef HAVE_ELIS1024
+	/* check size */
+	if (setup->wLength != sizeof(uint16_t) * 3) {
+		chug_set_error(CH_CMD_SET_RESAMPLE_GRID, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
+					 _recieve_resample_grid_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_SET_RESAMPLE_GRID, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+#ifdef HAVE_ELIS1024
+static uint8_t _set_hot_pixel_count;
+
+static int8_t
+_recieve_hot_pixels_cb(bool transfer_ok, void *context)
+{
+	ChError rc;
+	uint16_t *buf = (uint16_t *) _chug_buf;
+	uint8_t count = _set_hot_pixel_count;
+	uint8_t i;
+
+	/* error */
+	if (!transfer_ok) {
+		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
+		return -1;
+	}
+
+	/* sensor pixels, in ascending order with no duplicates */
+	for (i = 0; i < count; i++) {
+		if (buf[i] >= CH_SPECTRAL_NUM_PIXELS ||
+		    (i > 0 && buf[i] <= buf[i - 1])) {
+			chug_set_error(CH_CMD_SET_HOT_PIXELS, CH_ERROR_INVALID_VALUE);
+			return -1;
+		}
+	}
+	memcpy(_hot_pixels, buf, count * sizeof(uint16_t));
+	_hot_pixel_count = count;
+	rc = chug_calibration_save();
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_SET_HOT_PIXELS, rc);
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+static int8_t
+chug_handle_set_hot_pixels(const struct setup_packet *setup)
+{
+#ifdef HAVE_ELIS1024
+	ChError rc;
+
+	/* check size */
+	if (setup->wLength > sizeof(_hot_pixels) ||
+	    setup->wLength % sizeof(uint16_t) != 0) {
+		chug_set_error(CH_CMD_SET_HOT_PIXELS, CH_ERROR_INVALID_LENGTH);
+		return -1;
+	}
+
+	/* the readout uses the list */
+	if (oo_elis1024_get_state(&_elis1024_ctx) != CH_SPECTRAL_STATE_IDLE) {
+		chug_set_error(CH_CMD_SET_HOT_PIXELS, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+
+	/* no data stage, so just clear the list */
+	if (setup->wLength == 0) {
+		_hot_pixel_count = 0;
+		rc = chug_calibration_save();
+		if (rc != CH_ERROR_NONE) {
+			chug_set_error(CH_CMD_SET_HOT_PIXELS, rc);
+			return -1;
+		}
+		usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
+		return 0;
+	}
+	_set_hot_pixel_count = setup->wLength / sizeof(uint16_t);
+	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
+					 _recieve_hot_pixels_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_SET_HOT_PIXELS, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+#ifdef HAVE_ELIS1024
+static int8_t
+_recieve_linearity_cb(bool transfer_ok, void *context)
+{
+	ChError rc;
+	uint16_t *buf = (uint16_t *) _chug_buf;
+	uint8_t i;
+
+	/* error */
+	if (!transfer_ok) {
+		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
+		return -1;
+	}
+
+	/* a response never decreases */
+	for (i = 1; i < CH_LINEARITY_POINTS; i++) {
+		if (buf[i] < buf[i - 1]) {
+			chug_set_error(CH_CMD_SET_LINEARITY, CH_ERROR_INVALID_VALUE);
+			return -1;
+		}
+	}
+	memcpy(_linearity, buf, sizeof(_linearity));
+	_linearity_valid = TRUE;
+	rc = chug_calibration_save();
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_SET_LINEARITY, rc);
+		return -1;
+	}
 	return 0;
 }
+#endif
 
 static int8_t
-chug_handle_write_sram(const struct setup_packet *setup)
+chug_handle_set_linearity(const struct setup_packet *setup)
 {
+#ifdef HAVE_ELIS1024
+	ChError rc;
+
 	/* check size */
-	if (setup->wLength > sizeof(_chug_buf)) {
-		chug_set_error(CH_CMD_WRITE_SRAM, CH_ERROR_INVALID_LENGTH);
+	if (setup->wLength != 0 && setup->wLength != sizeof(_linearity)) {
+		chug_set_error(CH_CMD_SET_LINEARITY, CH_ERROR_INVALID_LENGTH);
 		return -1;
 	}
 
-	/* receive data */
-	_write_sram_addr = setup->wValue;
-	_write_sram_len = setup->wLength;
+	/* the readout uses the table */
+	if (oo_elis1024_get_state(&_elis1024_ctx) != CH_SPECTRAL_STATE_IDLE) {
+		chug_set_error(CH_CMD_SET_LINEARITY, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+
+	/* no data stage, so just remove the table */
+	if (setup->wLength == 0) {
+		_linearity_valid = FALSE;
+		rc = chug_calibration_save();
+		if (rc != CH_ERROR_NONE) {
+			chug_set_error(CH_CMD_SET_LINEARITY, rc);
+			return -1;
+		}
+		usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
+		return 0;
+	}
 	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
-					 _recieve_data_sram_cb, NULL);
+					 _recieve_linearity_cb, NULL);
 	return 0;
+#else
+	chug_set_error(CH_CMD_SET_LINEARITY, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
 }
 
 static int8_t
-_recieve_spectral_calibration_cb(bool transfer_ok, void *context)
+chug_handle_set_readout_profile(const struct setup_packet *setup)
 {
-	/* error */
-	if (!transfer_ok) {
-		chug_errno_show(CH_ERROR_DEVICE_DEACTIVATED, FALSE);
+#ifdef HAVE_ELIS1024
+	ChError rc;
+
+	rc = oo_elis1024_set_profile(&_elis1024_ctx, setup->wValue);
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_SET_READOUT_PROFILE, rc);
 		return -1;
 	}
+	usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_SET_READOUT_PROFILE, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
 
-	/* save to EEPROM */
-	memcpy(_cfg.wavelength_cal, _chug_buf, sizeof(int32_t) * 4);
-	chug_config_write(&_cfg);
+static int8_t
+chug_handle_set_oversample(const struct setup_packet *setup)
+{
+#ifdef HAVE_ELIS1024
+	ChError rc;
+
+	rc = oo_elis1024_set_oversample(&_elis1024_ctx, setup->wValue);
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_SET_OVERSAMPLE, rc);
+		return -1;
+	}
+	usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
 	return 0;
+#else
+	chug_set_error(CH_CMD_SET_OVERSAMPLE, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
 }
 
 static int8_t
-chug_handle_set_wavelength_calibration(const struct setup_packet *setup)
+chug_handle_set_binning(const struct setup_packet *setup)
 {
-	/* check size */
-	if (setup->wLength != sizeof(int32_t) * 4) {
-		chug_set_error(CH_CMD_SET_CCD_CALIBRATION, CH_ERROR_INVALID_LENGTH);
+#ifdef HAVE_ELIS1024
+	ChError rc;
+
+	rc = oo_elis1024_set_binning(&_elis1024_ctx, setup->wValue);
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_SET_BINNING, rc);
 		return -1;
 	}
-	usb_start_receive_ep0_data_stage(_chug_buf, setup->wLength,
-					 _recieve_spectral_calibration_cb, NULL);
+	usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
 	return 0;
+#else
+	chug_set_error(CH_CMD_SET_BINNING, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
 }
 
 static int8_t
@@ -426,18 +2060,157 @@ chug_handle_set_crypto_key(const struct setup_packet *setup)
 static int8_t
 chug_handle_take_reading_spectral(const struct setup_packet *setup)
 {
+#ifdef HAVE_ELIS1024
 	ChError rc;
-	uint16_t offset = 0;
 
-	chug_set_leds(0);
-	rc = oo_elis1024_take_sample(_integration_time, offset);
+	/* wValue is the number of frames to average */
+	if (_stream_state != CH_STREAM_STATE_IDLE) {
+		chug_set_error(CH_CMD_TAKE_READING_SPECTRAL, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+	rc = chug_spectral_start(setup->wValue, FALSE);
 	if (rc != CH_ERROR_NONE) {
 		chug_set_error(CH_CMD_TAKE_READING_SPECTRAL, rc);
 		return -1;
 	}
 	usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
 	return 0;
+#else
+	chug_set_error(CH_CMD_TAKE_READING_SPECTRAL, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+static int8_t
+chug_handle_take_reading_dark(const struct setup_packet *setup)
+{
+#ifdef HAVE_ELIS1024
+	ChError rc;
+
+	/* the dark frame is never dark subtracted, and wValue is the number
+	 * of frames to average */
+	if (_stream_state != CH_STREAM_STATE_IDLE) {
+		chug_set_error(CH_CMD_TAKE_READING_DARK, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+	rc = chug_spectral_claim_accumulator(setup->wValue);
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_TAKE_READING_DARK, rc);
+		return -1;
+	}
+	chug_set_leds(0);
+	oo_elis1024_set_dark_subtract(&_elis1024_ctx, FALSE);
+	oo_elis1024_set_auto_exposure(&_elis1024_ctx, FALSE);
+	rc = oo_elis1024_start_sample(&_elis1024_ctx,
+				      _integration_time,
+				      setup->wValue,
+				      CH_SRAM_OFFSET(CH_SRAM_REGION_DARK));
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_TAKE_READING_DARK, rc);
+		return -1;
+	}
+
+	/* save the conditions so we know when to invalidate it */
+	_dark_valid = FALSE;
+	_dark_pending = TRUE;
+	_dark_integration_time = _integration_time;
+	_dark_pixel_start = _elis1024_ctx.pixel_start;
+	_dark_pixel_length = _elis1024_ctx.pixel_length;
+	_dark_binning = _elis1024_ctx.binning;
+	_dark_temperature = chug_dark_get_temperature();
+	usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_TAKE_READING_DARK, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+static int8_t
+chug_handle_get_spectral_status(const struct setup_packet *setup)
+{
+#ifdef HAVE_ELIS1024
+	_chug_buf[0] = oo_elis1024_get_state(&_elis1024_ctx);
+	usb_send_data_stage(_chug_buf, 1, _send_data_stage_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_GET_SPECTRAL_STATUS, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+static int8_t
+chug_handle_start_streaming(const struct setup_packet *setup)
+{
+#ifdef HAVE_ELIS1024
+	ChError rc;
+
+	if (_stream_state != CH_STREAM_STATE_IDLE) {
+		chug_set_error(CH_CMD_START_STREAMING, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+#ifdef HAVE_SRAM
+	if (chug_sram_bulk_is_active()) {
+		chug_set_error(CH_CMD_START_STREAMING, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+#endif
+
+	/* frames are sent on EP1 until stopped, and wValue is the number
+	 * of frames to average for each one; single frames that are sent
+	 * as-is can be integrated while the last one is read out */
+	_stream_pipelined = setup->wValue <= 1 &&
+			    (_spectral_flags & (CH_SPECTRAL_FLAG_AUTO_EXPOSURE |
+						CH_SPECTRAL_FLAG_RESAMPLE |
+						CH_SPECTRAL_FLAG_SMOOTH_5 |
+						CH_SPECTRAL_FLAG_SMOOTH_9)) == 0;
+	if (_stream_pipelined) {
+		rc = chug_sram_claim(CH_SRAM_REGION_SPECTRUM_ALT,
+				     chug_sram_get_region(CH_SRAM_REGION_SPECTRUM_ALT)->size);
+		if (rc != CH_ERROR_NONE) {
+			chug_set_error(CH_CMD_START_STREAMING, rc);
+			_stream_pipelined = FALSE;
+			return -1;
+		}
+	}
+	rc = chug_spectral_start(setup->wValue, _stream_pipelined);
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_START_STREAMING, rc);
+		chug_sram_release(CH_SRAM_REGION_SPECTRUM_ALT);
+		_stream_pipelined = FALSE;
+		return -1;
+	}
+	_stream_frames = setup->wValue;
+	_stream_sequence = _spectral_sequence;
+	_stream_sequence_start = _spectral_sequence;
+	_stream_state = CH_STREAM_STATE_ACQUIRING;
+	usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_START_STREAMING, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+#ifdef HAVE_ELIS1024
+/* starts a reading that chug_spectral_poll() converts to XYZ */
+static ChError
+chug_spectral_start_xyz(uint16_t frames)
+{
+	ChError rc;
+
+	/* the CIE wavelengths have to be converted to pixels */
+	if (_cfg.wavelength_cal[1] <= 0)
+		return CH_ERROR_NO_CALIBRATION;
+	if (_stream_state != CH_STREAM_STATE_IDLE)
+		return CH_ERROR_DEVICE_BUSY;
+	rc = chug_spectral_start(frames, FALSE);
+	if (rc != CH_ERROR_NONE)
+		return rc;
+	_spectral_xyz_pending = TRUE;
+	return CH_ERROR_NONE;
 }
+#endif
 
 static int8_t
 chug_handle_take_reading_xyz(const struct setup_packet *setup)
@@ -456,12 +2229,140 @@ chug_handle_take_reading_xyz(const struct setup_packet *setup)
 	usb_send_data_stage(_chug_buf, sizeof(int32_t) * 3,
 			    _send_data_stage_cb, NULL);
 	return 0;
+#elif defined(HAVE_ELIS1024)
+	ChError rc;
+
+	/* take a spectrum and block until it is complete, like the MCDC04,
+	 * where wValue is the number of frames to average; hosts that do not
+	 * want to stall EP0 use START_READING_XYZ instead */
+	rc = chug_spectral_start_xyz(setup->wValue);
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_TAKE_READING_XYZ, rc);
+		return -1;
+	}
+	while (_spectral_xyz_pending) {
+		CLRWDT();
+		chug_spectral_poll();
+	}
+
+	/* the readout failed */
+	if (!_spectral_xyz_valid) {
+		chug_set_error(CH_CMD_TAKE_READING_XYZ, _last_error);
+		return -1;
+	}
+	memcpy(_chug_buf, _spectral_xyz, sizeof(int32_t) * 3);
+	usb_send_data_stage(_chug_buf, sizeof(int32_t) * 3,
+			    _send_data_stage_cb, NULL);
+	return 0;
 #else
 	chug_set_error(CH_CMD_TAKE_READING_XYZ, CH_ERROR_NOT_IMPLEMENTED);
 	return -1;
 #endif
 }
 
+static int8_t
+chug_handle_start_reading_xyz(const struct setup_packet *setup)
+{
+#ifdef HAVE_ELIS1024
+	ChError rc;
+
+	/* averaging and auto-exposure can take seconds, so this only starts
+	 * the reading, where wValue is the number of frames to average; the
+	 * host polls GET_SPECTRAL_STATUS and then uses GET_SPECTRAL_XYZ */
+	rc = chug_spectral_start_xyz(setup->wValue);
+	if (rc != CH_ERROR_NONE) {
+		chug_set_error(CH_CMD_START_READING_XYZ, rc);
+		return -1;
+	}
+	usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_START_READING_XYZ, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+static int8_t
+chug_handle_get_spectral_xyz(const struct setup_packet *setup)
+{
+#ifdef HAVE_ELIS1024
+	if (_spectral_xyz_pending) {
+		chug_set_error(CH_CMD_GET_SPECTRAL_XYZ, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+
+	/* no START_READING_XYZ since the last reading */
+	if (!_spectral_xyz_valid) {
+		chug_set_error(CH_CMD_GET_SPECTRAL_XYZ, CH_ERROR_INCOMPLETE_REQUEST);
+		return -1;
+	}
+	memcpy(_chug_buf, _spectral_xyz, sizeof(int32_t) * 3);
+	usb_send_data_stage(_chug_buf, sizeof(int32_t) * 3,
+			    _send_data_stage_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_GET_SPECTRAL_XYZ, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+static int8_t
+chug_handle_get_spectral_peaks(const struct setup_packet *setup)
+{
+#ifdef HAVE_ELIS1024
+	uint8_t max = setup->wValue & 0xff;
+	uint8_t width = setup->wValue >> 8;
+	uint8_t found;
+
+	/* the low byte is the number of peaks, and the high byte how many
+	 * pixels either side each one has to be the highest of */
+	if (width == 0)
+		width = 1;
+	if (max == 0 || max > CH_SPECTRAL_PEAKS_MAX ||
+	    width > CH_SPECTRAL_PEAK_WIDTH_MAX) {
+		chug_set_error(CH_CMD_GET_SPECTRAL_PEAKS, CH_ERROR_INVALID_VALUE);
+		return -1;
+	}
+	if (_cfg.wavelength_cal[1] <= 0) {
+		chug_set_error(CH_CMD_GET_SPECTRAL_PEAKS, CH_ERROR_NO_CALIBRATION);
+		return -1;
+	}
+
+	/* the stored spectrum is still being written */
+	if (_spectral_pending) {
+		chug_set_error(CH_CMD_GET_SPECTRAL_PEAKS, CH_ERROR_DEVICE_BUSY);
+		return -1;
+	}
+	found = chug_spectral_find_peaks((ChSpectralPeak *) _chug_buf,
+					 max, width);
+	usb_send_data_stage(_chug_buf, found * sizeof(ChSpectralPeak),
+			    _send_data_stage_cb, NULL);
+	return 0;
+#else
+	chug_set_error(CH_CMD_GET_SPECTRAL_PEAKS, CH_ERROR_NOT_IMPLEMENTED);
+	return -1;
+#endif
+}
+
+static int8_t
+chug_handle_get_sram_region(const struct setup_packet *setup)
+{
+	ChSramRegion *region;
+	uint8_t id = setup->wValue & 0xff;
+
+	if (id >= CH_SRAM_REGION_LAST) {
+		chug_set_error(CH_CMD_GET_SRAM_REGION, CH_ERROR_INVALID_VALUE);
+		return -1;
+	}
+	region = (ChSramRegion *) _chug_buf;
+	memcpy(region, chug_sram_get_region(id), sizeof(ChSramRegion));
+	if (chug_sram_is_live(id))
+		region->flags |= CH_SRAM_REGION_FLAG_LIVE;
+	usb_send_data_stage(_chug_buf, sizeof(ChSramRegion),
+			    _send_data_stage_cb, NULL);
+	return 0;
+}
+
 int8_t
 process_chug_setup_request(struct setup_packet *setup)
 {
@@ -498,8 +2399,88 @@ process_chug_setup_request(struct setup_packet *setup)
 		memcpy(_chug_buf, &_integration_time, 2);
 		usb_send_data_stage(_chug_buf, 2, _send_data_stage_cb, NULL);
 		return 0;
+#ifdef HAVE_ELIS1024
+	case CH_CMD_GET_BINNING:
+		_chug_buf[0] = _elis1024_ctx.binning;
+		usb_send_data_stage(_chug_buf, 1, _send_data_stage_cb, NULL);
+		return 0;
+	case CH_CMD_GET_OVERSAMPLE:
+		_chug_buf[0] = _elis1024_ctx.oversample;
+		usb_send_data_stage(_chug_buf, 1, _send_data_stage_cb, NULL);
+		return 0;
+	case CH_CMD_GET_HOT_PIXELS:
+		memcpy(_chug_buf, _hot_pixels,
+		       _hot_pixel_count * sizeof(uint16_t));
+		usb_send_data_stage(_chug_buf,
+				    _hot_pixel_count * sizeof(uint16_t),
+				    _send_data_stage_cb, NULL);
+		return 0;
+	case CH_CMD_GET_LINEARITY:
+		if (!_linearity_valid) {
+			usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
+			return 0;
+		}
+		memcpy(_chug_buf, _linearity, sizeof(_linearity));
+		usb_send_data_stage(_chug_buf, sizeof(_linearity),
+				    _send_data_stage_cb, NULL);
+		return 0;
+	case CH_CMD_GET_READOUT_PROFILE:
+		_chug_buf[0] = _elis1024_ctx.profile;
+		usb_send_data_stage(_chug_buf, 1, _send_data_stage_cb, NULL);
+		return 0;
+	case CH_CMD_GET_READOUT_TIMES:
+		/* the last readout time in us for each profile, or 0, then
+		 * the time taken by the last smoothing pass */
+		memcpy(_chug_buf, _elis1024_ctx.profile_time,
+		       sizeof(_elis1024_ctx.profile_time));
+		memcpy(_chug_buf + sizeof(_elis1024_ctx.profile_time),
+		       &_spectral_smooth_time, 4);
+		usb_send_data_stage(_chug_buf,
+				    sizeof(_elis1024_ctx.profile_time) + 4,
+				    _send_data_stage_cb, NULL);
+		return 0;
+#endif
 	case CH_CMD_READ_SRAM:
 		return chug_handle_read_sram(setup);
+	case CH_CMD_READ_SRAM_ENCODED:
+		return chug_handle_read_sram_encoded(setup);
+	case CH_CMD_GET_SRAM_CRC:
+		return chug_handle_get_sram_crc(setup);
+	case CH_CMD_GET_SRAM_REGION:
+		return chug_handle_get_sram_region(setup);
+	case CH_CMD_GET_SPECTRAL_PEAKS:
+		return chug_handle_get_spectral_peaks(setup);
+	case CH_CMD_GET_SPECTRAL_XYZ:
+		return chug_handle_get_spectral_xyz(setup);
+	case CH_CMD_GET_SPECTRAL_STATUS:
+		return chug_handle_get_spectral_status(setup);
+#ifdef HAVE_ELIS1024
+	case CH_CMD_GET_SPECTRAL_FLAGS:
+		memcpy(_chug_buf, &_spectral_flags, 2);
+		usb_send_data_stage(_chug_buf, 2, _send_data_stage_cb, NULL);
+		return 0;
+	case CH_CMD_GET_PIXEL_WINDOW:
+		memcpy(_chug_buf + 0, &_elis1024_ctx.pixel_start, 2);
+		memcpy(_chug_buf + 2, &_elis1024_ctx.pixel_length, 2);
+		usb_send_data_stage(_chug_buf, 4, _send_data_stage_cb, NULL);
+		return 0;
+	case CH_CMD_GET_SPECTRAL_HEADER:
+		memcpy(_chug_buf, &_spectral_header, sizeof(ChSpectralHeader));
+		usb_send_data_stage(_chug_buf, sizeof(ChSpectralHeader),
+				    _send_data_stage_cb, NULL);
+		return 0;
+	case CH_CMD_GET_RESAMPLE_GRID:
+		memcpy(_chug_buf + 0, &_resample_start, 2);
+		memcpy(_chug_buf + 2, &_resample_step, 2);
+		memcpy(_chug_buf + 4, &_resample_count, 2);
+		usb_send_data_stage(_chug_buf, 6, _send_data_stage_cb, NULL);
+		return 0;
+	case CH_CMD_GET_SPECTRAL_STATS:
+		memcpy(_chug_buf, &_spectral_stats, sizeof(ChSpectralStats));
+		usb_send_data_stage(_chug_buf, sizeof(ChSpectralStats),
+				    _send_data_stage_cb, NULL);
+		return 0;
+#endif
 	case CH_CMD_GET_CCD_CALIBRATION:
 		memcpy(_chug_buf, _cfg.wavelength_cal, sizeof(int32_t) * 4);
 		usb_send_data_stage(_chug_buf, sizeof(int32_t) * 4,
@@ -548,10 +2529,34 @@ process_chug_setup_request(struct setup_packet *setup)
 		_integration_time = setup->wValue;
 		usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
 		return 0;
+	case CH_CMD_SET_BINNING:
+		return chug_handle_set_binning(setup);
+	case CH_CMD_SET_OVERSAMPLE:
+		return chug_handle_set_oversample(setup);
+	case CH_CMD_SET_READOUT_PROFILE:
+		return chug_handle_set_readout_profile(setup);
+	case CH_CMD_SET_HOT_PIXELS:
+		return chug_handle_set_hot_pixels(setup);
+	case CH_CMD_SET_LINEARITY:
+		return chug_handle_set_linearity(setup);
 	case CH_CMD_WRITE_SRAM:
 		return chug_handle_write_sram(setup);
+	case CH_CMD_READ_SRAM_BULK:
+		return chug_handle_read_sram_bulk(setup);
+	case CH_CMD_WRITE_SRAM_BULK:
+		return chug_handle_write_sram_bulk(setup);
+#ifdef HAVE_ELIS1024
+	case CH_CMD_SET_SPECTRAL_FLAGS:
+		_spectral_flags = setup->wValue;
+		usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
+		return 0;
+#endif
 	case CH_CMD_SET_CCD_CALIBRATION:
 		return chug_handle_set_wavelength_calibration(setup);
+	case CH_CMD_SET_PIXEL_WINDOW:
+		return chug_handle_set_pixel_window(setup);
+	case CH_CMD_SET_RESAMPLE_GRID:
+		return chug_handle_set_resample_grid(setup);
 	case CH_CMD_SET_CRYPTO_KEY:
 		return chug_handle_set_crypto_key(setup);
 
@@ -564,12 +2569,33 @@ process_chug_setup_request(struct setup_packet *setup)
 		return chug_handle_take_reading_spectral(setup);
 	case CH_CMD_TAKE_READING_XYZ:
 		return chug_handle_take_reading_xyz(setup);
+	case CH_CMD_START_READING_XYZ:
+		return chug_handle_start_reading_xyz(setup);
+	case CH_CMD_TAKE_READING_DARK:
+		return chug_handle_take_reading_dark(setup);
+	case CH_CMD_START_STREAMING:
+		return chug_handle_start_streaming(setup);
+#ifdef HAVE_ELIS1024
+	case CH_CMD_STOP_STREAMING:
+		/* any frame being sent is not completed */
+		chug_stream_stop();
+		usb_send_data_stage(NULL, 0, _send_data_stage_cb, NULL);
+		return 0;
+#endif
 	case CH_CMD_LOAD_SRAM:
 		/* read the 0x2000 (8k) bytes of shadow memory from eeprom */
-		return chug_flash_load_sram(CH_SRAM_ADDRESS_WRDS, 0x2000);
+		return chug_flash_load_sram(CH_SRAM_ADDRESS_WRDS,
+					    chug_sram_get_region(CH_SRAM_REGION_SHADOW)->size);
 	case CH_CMD_SAVE_SRAM:
 		/* write int8_t 0x2000 (8k) bytes of shadow memory to eeprom */
-		return chug_flash_save_sram(CH_SRAM_ADDRESS_WRDS, 0x2000);
+		return chug_flash_save_sram(CH_SRAM_ADDRESS_WRDS,
+					    chug_sram_get_region(CH_SRAM_REGION_SHADOW)->size);
+	case CH_CMD_FILL_SRAM:
+		return chug_handle_fill_sram(setup);
+	case CH_CMD_COPY_SRAM:
+		return chug_handle_copy_sram(setup);
+	case CH_CMD_CALCULATE_SRAM_CRC:
+		return chug_handle_calculate_sram_crc(setup);
 	default:
 		chug_set_error(setup->bRequest, CH_ERROR_UNKNOWN_CMD);
 	}
@@ -592,6 +2618,12 @@ chug_usb_reset_callback(void)
 	/* reset back into DFU mode */
 	if (usb_dfu_get_state() == DFU_STATE_APP_DETACH)
 		RESET();
+#ifdef HAVE_SRAM
+	chug_sram_bulk_stop();
+#endif
+#ifdef HAVE_ELIS1024
+	chug_stream_stop();
+#endif
 }
 
 void interrupt high_priority
@@ -22,6 +22,7 @@
 #include "mti_23k640.h"
 
 #include <spi.h>
+#include <stddef.h>
 
 /* this is for the 23K640 */
 typedef enum {
@@ -38,6 +39,25 @@ typedef enum {
 	MTI_23K640_COMMAND_STATUS_READ	= 0x05
 } ChSramCommand;
 
+/* the DMA byte count is 10 bits */
+#define MTI_23K640_DMA_LENGTH_MAX	1024
+
+/* transfers waiting for the DMA engine, the first being in progress */
+#define MTI_23K640_DMA_QUEUE_SIZE	4
+
+typedef struct {
+	uint8_t			*addr_cpu;
+	uint16_t		 addr_ram;
+	uint16_t		 length;
+	uint8_t			 to_cpu;
+	Mti23k640DmaFunc	 func;
+	void			*user_data;
+} Mti23k640DmaJob;
+
+static Mti23k640DmaJob		 _dma_queue[MTI_23K640_DMA_QUEUE_SIZE];
+static uint8_t			 _dma_head = 0;
+static uint8_t			 _dma_count = 0;
+
 /**
  * mti_23k640_enable:
  *
@@ -139,8 +159,8 @@ mti_23k640_dma_check (void)
 	return TRUE;
 }
 
-void
-mti_23k640_dma_from_cpu_prep (void)
+static void
+mti_23k640_dma_from_cpu_mode (void)
 {
 	/* set the SPI DMA engine to send-only data mode*/
 	DMACON1bits.DUPLEX1 = 0;
@@ -152,6 +172,19 @@ mti_23k640_dma_from_cpu_prep (void)
 	mti_23k640_set_mode(MTI_23K640_MODE_SEQUENTIAL);
 }
 
+/**
+ * mti_23k640_dma_from_cpu_prep:
+ *
+ * Finishes any queued transfers, then gets ready for one or more calls to
+ * mti_23k640_dma_from_cpu_exec().
+ **/
+void
+mti_23k640_dma_from_cpu_prep (void)
+{
+	mti_23k640_dma_flush();
+	mti_23k640_dma_from_cpu_mode();
+}
+
 void
 mti_23k640_dma_from_cpu_exec (const uint8_t *addr_cpu, uint16_t addr_ram, uint16_t length)
 {
@@ -186,8 +219,8 @@ mti_23k640_dma_from_cpu (const uint8_t *addr_cpu, uint16_t addr_ram, uint16_t le
 	mti_23k640_dma_from_cpu_exec(addr_cpu, addr_ram, length);
 }
 
-void
-mti_23k640_dma_to_cpu_prep (void)
+static void
+mti_23k640_dma_to_cpu_mode (void)
 {
 	/* set the SPI DMA engine to receive-only data mode */
 	DMACON1bits.DUPLEX1 = 0;
@@ -199,6 +232,19 @@ mti_23k640_dma_to_cpu_prep (void)
 	mti_23k640_set_mode(MTI_23K640_MODE_SEQUENTIAL);
 }
 
+/**
+ * mti_23k640_dma_to_cpu_prep:
+ *
+ * Finishes any queued transfers, then gets ready for one or more calls to
+ * mti_23k640_dma_to_cpu_exec().
+ **/
+void
+mti_23k640_dma_to_cpu_prep (void)
+{
+	mti_23k640_dma_flush();
+	mti_23k640_dma_to_cpu_mode();
+}
+
 void
 mti_23k640_dma_to_cpu_exec (uint16_t addr_ram, uint8_t *addr_cpu, uint16_t length)
 {
@@ -233,25 +279,233 @@ mti_23k640_dma_to_cpu (uint16_t addr_ram, uint8_t *addr_cpu, uint16_t length)
 	mti_23k640_dma_to_cpu_exec(addr_ram, addr_cpu, length);
 }
 
+/* starts the transfer at the head of the queue */
+static void
+mti_23k640_dma_start (const Mti23k640DmaJob *job)
+{
+	if (job->to_cpu) {
+		mti_23k640_dma_to_cpu_mode();
+		mti_23k640_dma_to_cpu_exec(job->addr_ram,
+					   job->addr_cpu,
+					   job->length);
+		return;
+	}
+	mti_23k640_dma_from_cpu_mode();
+	mti_23k640_dma_from_cpu_exec(job->addr_cpu,
+				     job->addr_ram,
+				     job->length);
+}
+
+static int8_t
+mti_23k640_dma_queue (uint8_t *addr_cpu, uint16_t addr_ram, uint16_t length,
+		      uint8_t to_cpu, Mti23k640DmaFunc func, void *user_data)
+{
+	Mti23k640DmaJob *job;
+
+	if (_dma_count == MTI_23K640_DMA_QUEUE_SIZE)
+		return -1;
+	job = &_dma_queue[(_dma_head + _dma_count) % MTI_23K640_DMA_QUEUE_SIZE];
+	job->addr_cpu = addr_cpu;
+	job->addr_ram = addr_ram;
+	job->length = length;
+	job->to_cpu = to_cpu;
+	job->func = func;
+	job->user_data = user_data;
+
+	/* the engine is idle, as blocking transfers always wait */
+	if (_dma_count++ == 0)
+		mti_23k640_dma_start(job);
+	return 0;
+}
+
+/**
+ * mti_23k640_dma_queue_from_cpu:
+ * @addr_cpu: the data to write, which has to stay valid until @func is called
+ * @addr_ram: the SRAM address
+ * @length: up to 1024 bytes
+ * @func: (allow-none): called from mti_23k640_dma_poll() when complete
+ * @user_data: passed to @func
+ *
+ * Queues a CPU->SRAM transfer, starting it now if the DMA engine is idle.
+ * This never blocks.
+ *
+ * @func may queue more transfers, but must not use the blocking functions.
+ *
+ * Return value: 0 for success, or -1 if the queue is full
+ **/
+int8_t
+mti_23k640_dma_queue_from_cpu (const uint8_t *addr_cpu, uint16_t addr_ram,
+			       uint16_t length, Mti23k640DmaFunc func,
+			       void *user_data)
+{
+	return mti_23k640_dma_queue((uint8_t *) addr_cpu, addr_ram, length,
+				    FALSE, func, user_data);
+}
+
+/**
+ * mti_23k640_dma_queue_to_cpu:
+ * @addr_ram: the SRAM address
+ * @addr_cpu: where to store the data, which is valid when @func is called
+ * @length: up to 1024 bytes
+ * @func: (allow-none): called from mti_23k640_dma_poll() when complete
+ * @user_data: passed to @func
+ *
+ * Queues a SRAM->CPU transfer, starting it now if the DMA engine is idle.
+ * This never blocks.
+ *
+ * @func may queue more transfers, but must not use the blocking functions.
+ *
+ * Return value: 0 for success, or -1 if the queue is full
+ **/
+int8_t
+mti_23k640_dma_queue_to_cpu (uint16_t addr_ram, uint8_t *addr_cpu,
+			     uint16_t length, Mti23k640DmaFunc func,
+			     void *user_data)
+{
+	return mti_23k640_dma_queue(addr_cpu, addr_ram, length,
+				    TRUE, func, user_data);
+}
+
+/**
+ * mti_23k640_dma_poll:
+ *
+ * If the queued transfer in progress has finished then disable the SRAM,
+ * start the next one and call the completion callback.
+ **/
 void
-mti_23k640_wipe (uint16_t addr, uint16_t length)
+mti_23k640_dma_poll (void)
 {
-	uint8_t buffer[8];
-	uint16_t i;
+	Mti23k640DmaFunc func;
+	void *user_data;
 
-	/* use 0xff as 'clear' */
-	for (i = 0; i < 8; i++)
-		buffer[i] = 0xff;
+	if (_dma_count == 0 || DMACON1bits.DMAEN)
+		return;
+	mti_23k640_disable();
+
+	/* the callback may queue into the slot being freed */
+	func = _dma_queue[_dma_head].func;
+	user_data = _dma_queue[_dma_head].user_data;
+	_dma_head = (_dma_head + 1) % MTI_23K640_DMA_QUEUE_SIZE;
+
+	/* keep the SPI bus busy while the callback runs */
+	if (--_dma_count > 0)
+		mti_23k640_dma_start(&_dma_queue[_dma_head]);
+	if (func != NULL)
+		func(user_data);
+}
+
+/**
+ * mti_23k640_dma_flush:
+ *
+ * Hang the CPU until all the queued transfers have finished and their
+ * callbacks have been called.
+ **/
+void
+mti_23k640_dma_flush (void)
+{
+	while (_dma_count > 0) {
+		ClrWdt();
+		mti_23k640_dma_poll();
+	}
+}
+
+/**
+ * mti_23k640_fill:
+ * @addr: the SRAM address
+ * @value: the byte to write
+ * @length: any number of bytes
+ *
+ * Sets an area of the SRAM to one value, like memset().
+ * The DMA engine sends the same byte when the transmit address is not
+ * incremented, so this needs no bounce buffer and only one DMA transfer
+ * for each 1024 bytes.
+ * This blocks for the duration of the transfer.
+ **/
+void
+mti_23k640_fill (uint16_t addr, uint8_t value, uint16_t length)
+{
+	uint16_t chunk;
 
-	/* blit this to the entire area specified */
 	mti_23k640_dma_from_cpu_prep();
-	for (i = 0; i < length / 8; i++) {
+	DMACON1bits.TXINC = 0;
+	while (length > 0) {
 		ClrWdt();
-		mti_23k640_dma_from_cpu_exec(buffer, addr + i * 8, 8);
+		chunk = length;
+		if (chunk > MTI_23K640_DMA_LENGTH_MAX)
+			chunk = MTI_23K640_DMA_LENGTH_MAX;
+		mti_23k640_dma_from_cpu_exec(&value, addr, chunk);
 		mti_23k640_dma_wait();
+		addr += chunk;
+		length -= chunk;
+	}
+	DMACON1bits.TXINC = 1;
+}
+
+/* copies one chunk through the bounce buffer */
+static void
+mti_23k640_move_chunk (uint16_t dest, uint16_t src, uint16_t length, uint8_t *buf)
+{
+	ClrWdt();
+	mti_23k640_dma_to_cpu(src, buf, length);
+	mti_23k640_dma_wait();
+	mti_23k640_dma_from_cpu(buf, dest, length);
+	mti_23k640_dma_wait();
+}
+
+/**
+ * mti_23k640_move:
+ * @dest: the SRAM address to copy to
+ * @src: the SRAM address to copy from
+ * @length: any number of bytes
+ * @buf: a bounce buffer in RAM
+ * @buflen: the size of @buf, where larger is faster
+ *
+ * Copies an area of the SRAM to another, like memmove(), so the areas may
+ * overlap. Each chunk is read into @buf and then written back out, using
+ * the sequential mode for both transfers.
+ * This blocks for the duration of the transfer.
+ **/
+void
+mti_23k640_move (uint16_t dest, uint16_t src, uint16_t length,
+		 uint8_t *buf, uint16_t buflen)
+{
+	uint16_t chunk;
+	uint16_t offset;
+
+	if (dest == src || length == 0)
+		return;
+	if (buflen > MTI_23K640_DMA_LENGTH_MAX)
+		buflen = MTI_23K640_DMA_LENGTH_MAX;
+
+	/* copy from the end if the start of the destination overwrites
+	 * the end of the source */
+	if (dest > src && dest - src < length) {
+		offset = length;
+		while (offset > 0) {
+			chunk = offset;
+			if (chunk > buflen)
+				chunk = buflen;
+			offset -= chunk;
+			mti_23k640_move_chunk(dest + offset, src + offset,
+					      chunk, buf);
+		}
+		return;
+	}
+	for (offset = 0; offset < length; offset += chunk) {
+		chunk = length - offset;
+		if (chunk > buflen)
+			chunk = buflen;
+		mti_23k640_move_chunk(dest + offset, src + offset, chunk, buf);
 	}
 }
 
+void
+mti_23k640_wipe (uint16_t addr, uint16_t length)
+{
+	/* use 0xff as 'clear' */
+	mti_23k640_fill(addr, 0xff, length);
+}
+
 int8_t
 mti_23k640_self_test(void)
 {
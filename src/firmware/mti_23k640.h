@@ -25,6 +25,8 @@
 #include <xc.h>
 #include <stdint.h>
 
+typedef void	(*Mti23k640DmaFunc)		(void		*user_data);
+
 int8_t		 mti_23k640_self_test		(void);
 void		 mti_23k640_write_byte		(uint16_t	 addr,
 						 uint8_t	 data);
@@ -33,6 +35,14 @@ uint8_t		 mti_23k640_read_byte		(uint16_t	 addr);
 void		 mti_23k640_dma_wait		(void);
 void		 mti_23k640_wipe		(uint16_t	 addr,
 						 uint16_t	 length);
+void		 mti_23k640_fill		(uint16_t	 addr,
+						 uint8_t	 value,
+						 uint16_t	 length);
+void		 mti_23k640_move		(uint16_t	 dest,
+						 uint16_t	 src,
+						 uint16_t	 length,
+						 uint8_t	*buf,
+						 uint16_t	 buflen);
 uint8_t		 mti_23k640_dma_check		(void);
 
 void		 mti_23k640_dma_from_cpu_prep	(void);
@@ -51,4 +61,17 @@ void		 mti_23k640_dma_to_cpu		(uint16_t	 addr_ram,
 						 uint8_t	*addr_cpu,
 						 uint16_t	 length);
 
+int8_t		 mti_23k640_dma_queue_from_cpu	(const uint8_t	*addr_cpu,
+						 uint16_t	 addr_ram,
+						 uint16_t	 length,
+						 Mti23k640DmaFunc func,
+						 void		*user_data);
+int8_t		 mti_23k640_dma_queue_to_cpu	(uint16_t	 addr_ram,
+						 uint8_t	*addr_cpu,
+						 uint16_t	 length,
+						 Mti23k640DmaFunc func,
+						 void		*user_data);
+void		 mti_23k640_dma_poll		(void);
+void		 mti_23k640_dma_flush		(void);
+
 #endif /* __MTI_23K640_H */
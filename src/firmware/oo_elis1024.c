@@ -20,16 +20,63 @@
  */
 
 #include <xc.h>
+#include <string.h>
 
 #include "oo_elis1024.h"
 #include "mti_23k640.h"
 
+#include "ch-errno.h"
+#include "ch-spectral.h"
+#include "ch-timer.h"
+
 #define PIN_CLK			PORTCbits.RC6
 #define PIN_DATA		PORTDbits.RD1
 #define PIN_RM			PORTDbits.RD0
 #define PIN_RST			PORTEbits.RE2
 #define PIN_SHT			PORTAbits.RA1
 
+#define OO_ELIS1024_NUM_PIXELS		1024
+#define OO_ELIS1024_BLOCK_PIXELS	32
+#define OO_ELIS1024_ACC_PIXELS		16
+
+/* ADC and sensor timing for each #ChReadoutProfile */
+typedef struct {
+	uint8_t			adcs;		/* conversion clock */
+	uint8_t			acqt;		/* acquisition for a new pixel */
+	uint8_t			acqt_repeat;	/* acquisition when oversampling */
+	uint8_t			td;		/* us, before the first pixel */
+	uint8_t			clk;		/* us, half period when skipping */
+} OoElis1024Profile;
+
+/* TAD is 1.33us, 0.67us and 0.33us on both clock variants, the last being
+ * faster than the datasheet allows and so noisier */
+static const OoElis1024Profile _profiles[CH_READOUT_PROFILE_LAST] = {
+#ifdef HAVE_24MHZ
+	{ 0b010, 0b111, 0b010, 10, 1 },	/* Fosc/32, 20 TAD, 4 TAD */
+	{ 0b101, 0b100, 0b010, 5, 1 },	/* Fosc/16, 8 TAD, 4 TAD */
+	{ 0b001, 0b001, 0b001, 2, 0 },	/* Fosc/8, 2 TAD, 2 TAD */
+#else
+	{ 0b110, 0b111, 0b010, 10, 1 },	/* Fosc/64, 20 TAD, 4 TAD */
+	{ 0b010, 0b100, 0b010, 5, 1 },	/* Fosc/32, 8 TAD, 4 TAD */
+	{ 0b101, 0b001, 0b001, 2, 0 },	/* Fosc/16, 2 TAD, 2 TAD */
+#endif
+};
+
+/* auto-exposure aims for the peak pixel to be at 3/4 of FSD */
+#define OO_ELIS1024_AUTO_TARGET		0xc000
+#define OO_ELIS1024_AUTO_PROBE_TIME	10	/* ms */
+#define OO_ELIS1024_AUTO_PROBES		4
+
+/* RAM is scarce, so the readout and accumulate passes share a buffer */
+static union {
+	/* one block is DMA'd to the SRAM while the ADC fills the other */
+	uint16_t	 block[2][OO_ELIS1024_BLOCK_PIXELS];
+	struct {
+		uint16_t px[OO_ELIS1024_ACC_PIXELS];
+		uint32_t sum[OO_ELIS1024_ACC_PIXELS];
+	} acc;
+} _buf;
+
 void
 oo_elis1024_set_standby(void)
 {
@@ -38,35 +85,319 @@ oo_elis1024_set_standby(void)
 	PIN_CLK = 0;
 }
 
-static void
-oo_elis1024_wait_us(uint16_t cnt)
+/**
+ * oo_elis1024_init:
+ * @ctx: A #OoElis1024Context
+ *
+ * Sets up the context with no acquisition in progress.
+ **/
+void
+oo_elis1024_init(OoElis1024Context *ctx)
 {
-	cnt /= 2;
-	for (;cnt > 0; cnt--)
-		CLRWDT();
+	ctx->state = CH_SPECTRAL_STATE_IDLE;
+	ctx->integration_time = 0;
+	ctx->integration_max = 0;
+	ctx->offset = 0;
+	ctx->accumulator = 0;
+	ctx->dark = 0;
+	ctx->dark_subtract = FALSE;
+	ctx->hot_pixels = NULL;
+	ctx->hot_count = 0;
+	ctx->linearity = NULL;
+	ctx->frames = 1;
+	ctx->frames_done = 0;
+	ctx->sequence = 0;
+	ctx->continuous = FALSE;
+	ctx->pixel_start = 0;
+	ctx->pixel_length = OO_ELIS1024_NUM_PIXELS;
+	ctx->binning = 1;
+	ctx->oversample = 1;
+	ctx->profile = CH_READOUT_PROFILE_ACCURATE;
+	ctx->readout_time = 0;
+	memset(ctx->profile_time, 0, sizeof(ctx->profile_time));
+	ctx->auto_exposure = FALSE;
+	ctx->probes = 0;
+	memset(&ctx->stats, 0, sizeof(ChSpectralStats));
+	ctx->start_ms = 0;
+	ctx->start_ticks = 0;
 }
 
-static void
-oo_elis1024_wait_ms(uint16_t cnt)
+/**
+ * oo_elis1024_set_window:
+ * @ctx: A #OoElis1024Context
+ * @pixel_start: the first pixel to store
+ * @pixel_length: the number of pixels to store
+ *
+ * Sets the region of interest. Pixels outside the window are clocked out
+ * without an ADC conversion, and the pixels inside it are stored packed
+ * together from the sample offset.
+ *
+ * Returns: a #ChError, e.g. #CH_ERROR_INVALID_VALUE
+ **/
+uint8_t
+oo_elis1024_set_window(OoElis1024Context *ctx,
+		       uint16_t pixel_start,
+		       uint16_t pixel_length)
 {
-	for (;cnt > 0; cnt--)
-		oo_elis1024_wait_us(996);
+	if (ctx->state != CH_SPECTRAL_STATE_IDLE)
+		return CH_ERROR_DEVICE_BUSY;
+	if (pixel_length == 0 ||
+	    pixel_start >= OO_ELIS1024_NUM_PIXELS ||
+	    pixel_length > OO_ELIS1024_NUM_PIXELS - pixel_start)
+		return CH_ERROR_INVALID_VALUE;
+	ctx->pixel_start = pixel_start;
+	ctx->pixel_length = pixel_length;
+	return CH_ERROR_NONE;
 }
 
-/*
- * @integration_time: in ms
+/**
+ * oo_elis1024_set_binning:
+ * @ctx: A #OoElis1024Context
+ * @binning: the number of adjacent pixels to combine, 1, 2, 4 or 8
+ *
+ * Sets the binning factor. Adjacent pixels in the window are summed as they
+ * are clocked out and the rounded mean of each bin is stored, which keeps
+ * the ADC full scale. Oversampled or linearized values use the low bits, so
+ * the stored value can be up to half of the lowest bit away from the exact
+ * mean, which is a tiny fraction of the ADC resolution. If the window is
+ * not a multiple of the binning factor the last pixels of the window are
+ * not stored.
+ *
+ * Returns: a #ChError, e.g. #CH_ERROR_INVALID_VALUE
+ **/
+uint8_t
+oo_elis1024_set_binning(OoElis1024Context *ctx, uint16_t binning)
+{
+	if (ctx->state != CH_SPECTRAL_STATE_IDLE)
+		return CH_ERROR_DEVICE_BUSY;
+	switch (binning) {
+	case 1:
+	case 2:
+	case 4:
+	case 8:
+		break;
+	default:
+		return CH_ERROR_INVALID_VALUE;
+	}
+	ctx->binning = binning;
+	return CH_ERROR_NONE;
+}
+
+static uint8_t
+oo_elis1024_get_binning_shift(OoElis1024Context *ctx)
+{
+	uint8_t shift = 0;
+	while ((1 << shift) < ctx->binning)
+		shift++;
+	return shift;
+}
+
+/**
+ * oo_elis1024_set_oversample:
+ * @ctx: A #OoElis1024Context
+ * @oversample: the number of ADC conversions for each pixel, 1, 4 or 16
+ *
+ * Sets the oversampling factor. The pixel is held on the sensor output for
+ * as long as the clock is high, so the extra conversions only need a short
+ * acquisition time. The conversions are averaged into the 6 low bits that
+ * are otherwise zero, giving 1 extra bit for 4 conversions and 2 extra
+ * bits for 16, at the cost of a slower readout.
+ *
+ * Returns: a #ChError, e.g. #CH_ERROR_INVALID_VALUE
+ **/
+uint8_t
+oo_elis1024_set_oversample(OoElis1024Context *ctx, uint16_t oversample)
+{
+	if (ctx->state != CH_SPECTRAL_STATE_IDLE)
+		return CH_ERROR_DEVICE_BUSY;
+	switch (oversample) {
+	case 1:
+	case 4:
+	case 16:
+		break;
+	default:
+		return CH_ERROR_INVALID_VALUE;
+	}
+	ctx->oversample = oversample;
+	return CH_ERROR_NONE;
+}
+
+/**
+ * oo_elis1024_set_profile:
+ * @ctx: A #OoElis1024Context
+ * @profile: A #ChReadoutProfile
+ *
+ * Sets the ADC conversion clock and acquisition times, and the sensor
+ * clock timing, used for the readout. The faster profiles are noisier
+ * but useful when aligning the optics.
+ *
+ * Returns: a #ChError, e.g. #CH_ERROR_INVALID_VALUE
+ **/
+uint8_t
+oo_elis1024_set_profile(OoElis1024Context *ctx, uint16_t profile)
+{
+	if (ctx->state != CH_SPECTRAL_STATE_IDLE)
+		return CH_ERROR_DEVICE_BUSY;
+	if (profile >= CH_READOUT_PROFILE_LAST)
+		return CH_ERROR_INVALID_VALUE;
+	ctx->profile = profile;
+	return CH_ERROR_NONE;
+}
+
+/**
+ * oo_elis1024_get_pixel_count:
+ * @ctx: A #OoElis1024Context
+ *
+ * Gets the number of values stored for each frame.
+ *
+ * Returns: the number of uint16_t values, or 0 if the window is too small
+ **/
+uint16_t
+oo_elis1024_get_pixel_count(OoElis1024Context *ctx)
+{
+	return ctx->pixel_length >> oo_elis1024_get_binning_shift(ctx);
+}
+
+/**
+ * oo_elis1024_get_header:
+ * @ctx: A #OoElis1024Context
+ * @header: A #ChSpectralHeader
+ *
+ * Describes the frame being acquired, or the last frame taken if idle.
+ **/
+void
+oo_elis1024_get_header(OoElis1024Context *ctx, ChSpectralHeader *header)
+{
+	header->integration_time = ctx->integration_time;
+	header->frames = ctx->frames;
+	header->pixel_start = ctx->pixel_start;
+	header->pixel_length = ctx->pixel_length;
+	header->pixel_count = oo_elis1024_get_pixel_count(ctx);
+	header->binning = ctx->binning;
+	header->oversample = ctx->oversample;
+	header->adc_bits = 10;
+	if (ctx->oversample == 4)
+		header->adc_bits = 11;
+	else if (ctx->oversample == 16)
+		header->adc_bits = 12;
+	header->readout_time = 0xffff;
+	if (ctx->readout_time < 0xffff * 100UL)
+		header->readout_time = ctx->readout_time / 100;
+	header->flags = CH_SPECTRAL_FLAG_NONE;
+	if (ctx->dark_subtract)
+		header->flags |= CH_SPECTRAL_FLAG_DARK_SUBTRACT;
+	if (ctx->auto_exposure)
+		header->flags |= CH_SPECTRAL_FLAG_AUTO_EXPOSURE;
+	if (ctx->linearity != NULL)
+		header->flags |= CH_SPECTRAL_FLAG_LINEARIZE;
+}
+
+/**
+ * oo_elis1024_set_accumulator:
+ * @ctx: A #OoElis1024Context
+ * @accumulator: the SRAM address of up to 1024 uint32_t values
+ *
+ * Sets where the per-pixel sums are kept when averaging frames.
+ **/
+void
+oo_elis1024_set_accumulator(OoElis1024Context *ctx, uint16_t accumulator)
+{
+	ctx->accumulator = accumulator;
+}
+
+/**
+ * oo_elis1024_set_dark:
+ * @ctx: A #OoElis1024Context
+ * @dark: the SRAM address of a dark frame taken with the same window and binning
+ *
+ * Sets where the dark reference frame is kept.
+ **/
+void
+oo_elis1024_set_dark(OoElis1024Context *ctx, uint16_t dark)
+{
+	ctx->dark = dark;
+}
+
+/**
+ * oo_elis1024_set_hot_pixels:
+ * @ctx: A #OoElis1024Context
+ * @hot_pixels: defective pixel indexes in ascending order
+ * @hot_count: the number of defective pixels
+ *
+ * Sets the pixels that are replaced with a value from their neighbours
+ * during readout. Each one takes the value of the pixel read before it,
+ * so it never affects the statistics or a bin, and when not binning it is
+ * then interpolated from both neighbours in the stored frame. The first
+ * pixel read has no neighbour yet, so is only fixed in the stored frame.
+ *
+ * The array is not copied, and has to stay valid.
+ **/
+void
+oo_elis1024_set_hot_pixels(OoElis1024Context *ctx,
+			   const uint16_t *hot_pixels,
+			   uint8_t hot_count)
+{
+	ctx->hot_pixels = hot_pixels;
+	ctx->hot_count = hot_count;
+}
+
+/**
+ * oo_elis1024_set_linearity:
+ * @ctx: A #OoElis1024Context
+ * @linearity: %CH_LINEARITY_POINTS corrected values, or %NULL
+ *
+ * Sets the table used to correct the response of each pixel as it is
+ * read out, before any binning or dark subtraction. The saturation count
+ * is still taken from the raw value.
+ *
+ * The array is not copied, and has to stay valid.
+ **/
+void
+oo_elis1024_set_linearity(OoElis1024Context *ctx, const uint16_t *linearity)
+{
+	ctx->linearity = linearity;
+}
+
+/**
+ * oo_elis1024_set_dark_subtract:
+ * @ctx: A #OoElis1024Context
+ * @dark_subtract: %TRUE to subtract the dark frame during readout
+ *
+ * Sets if the dark frame is subtracted from each pixel as it is read out,
+ * saturating at zero. The caller is responsible for making sure the dark
+ * frame matches the integration time and temperature.
+ **/
+void
+oo_elis1024_set_dark_subtract(OoElis1024Context *ctx, uint8_t dark_subtract)
+{
+	ctx->dark_subtract = dark_subtract;
+}
+
+/**
+ * oo_elis1024_set_auto_exposure:
+ * @ctx: A #OoElis1024Context
+ * @auto_exposure: %TRUE to choose the integration time automatically
  *
+ * Sets if short probe frames are taken before the sample to predict the
+ * integration time that puts the peak pixel at 3/4 of FSD. The integration
+ * time passed to oo_elis1024_start_sample() is then the longest allowed,
+ * and the chosen time is saved in the context. This should not be used
+ * with dark subtraction, as the dark frame is only valid for one time.
+ **/
+void
+oo_elis1024_set_auto_exposure(OoElis1024Context *ctx, uint8_t auto_exposure)
+{
+	ctx->auto_exposure = auto_exposure;
+}
+
+/*
  * The ELIS is always run with M0=M1=0 which puts it in 1024 pixel mode and
  * is used with Frame Mode Timing, where RM=0
  */
-uint8_t
-oo_elis1024_take_sample(uint16_t integration_time, uint16_t offset)
+static void
+oo_elis1024_reset(void)
 {
-	uint16_t i;
-	uint16_t dma_buf = 0x0;
-
-	/* we read the pixels backwards */
-	offset += 1023 * 2;
+	uint8_t i;
 
 	/* device reset */
 	PIN_DATA = 0;
@@ -77,37 +408,150 @@ oo_elis1024_take_sample(uint16_t integration_time, uint16_t offset)
 	/* PIN_RST needs to be high for at least 200ns */
 	for (i = 0; i < 10; i++) {
 		PIN_CLK = 1;
-		oo_elis1024_wait_us(10);
+		chug_timer_wait_us(1);
 		PIN_CLK = 0;
-		oo_elis1024_wait_us(10);
+		chug_timer_wait_us(1);
 	}
-
-	/* start integration */
 	PIN_RST = 0;
-	if (integration_time > 0) {
-		PIN_SHT = 1;
-		oo_elis1024_wait_ms(integration_time);
-		PIN_SHT = 0;
-	} else {
-		PIN_SHT = 1;
-		PIN_SHT = 0;
+}
+
+/*
+ * Replaces each stored hot pixel with the mean of the pixels either side,
+ * or with the one neighbour at the edge of the window. This is only
+ * possible when not binning, as otherwise the neighbours are not stored.
+ */
+static void
+oo_elis1024_interpolate_hot(OoElis1024Context *ctx)
+{
+	uint16_t px[3];
+	uint16_t idx;
+	uint16_t first;
+	uint16_t addr;
+	uint8_t i;
+	uint8_t len;
+
+	for (i = 0; i < ctx->hot_count; i++) {
+		if (ctx->hot_pixels[i] < ctx->pixel_start)
+			continue;
+		idx = ctx->hot_pixels[i] - ctx->pixel_start;
+		if (idx >= ctx->pixel_length)
+			break;
+
+		/* fetch the hot pixel and any neighbours in the window */
+		first = idx > 0 ? idx - 1 : idx;
+		len = idx + 1 < ctx->pixel_length ? idx + 2 - first : idx + 1 - first;
+		if (len == 1)
+			continue;
+		addr = ctx->offset + first * sizeof(uint16_t);
+		mti_23k640_dma_to_cpu(addr, (uint8_t *) px, len * sizeof(uint16_t));
+		mti_23k640_dma_wait();
+		if (len == 3)
+			px[1] = ((uint32_t) px[0] + px[2] + 1) / 2;
+		else if (first == idx)
+			px[0] = px[1];
+		else
+			px[1] = px[0];
+		mti_23k640_dma_from_cpu((const uint8_t *) &px[idx - first],
+					addr + (idx - first) * sizeof(uint16_t),
+					sizeof(uint16_t));
+		mti_23k640_dma_wait();
+	}
+}
+
+/*
+ * Pixels are collected into a ping-pong pair of blocks and each full block
+ * is written to the SRAM with a single DMA transfer, so a frame costs 32
+ * command headers rather than one for every pixel. When binning, each
+ * block entry is the mean of the adjacent pixels in the bin.
+ *
+ * The statistics are collected from the unbinned pixel values as they are
+ * read so that the host can check the frame without downloading it, and
+ * the time the readout took is recorded so each setting can be compared.
+ */
+static void
+oo_elis1024_readout(OoElis1024Context *ctx)
+{
+	uint16_t i;
+	uint16_t i_first;
+	uint16_t i_last;
+	uint16_t remaining = oo_elis1024_get_pixel_count(ctx);
+	uint16_t *block = _buf.block[0];
+	uint16_t *other = _buf.block[1];
+	uint16_t *tmp;
+	uint16_t val;
+	uint16_t last = 0;
+	uint16_t hot_i = 0xffff;
+	uint32_t start_us = chug_timer_get_us();
+	uint8_t j = OO_ELIS1024_BLOCK_PIXELS;
+	uint8_t k;
+	uint8_t len;
+	uint8_t os_shift = ctx->oversample == 16 ? 4 : ctx->oversample / 2;
+	uint8_t shift = oo_elis1024_get_binning_shift(ctx);
+	uint8_t bin_left = ctx->binning;
+	uint8_t acqt = _profiles[ctx->profile].acqt;
+	uint8_t acqt_repeat = _profiles[ctx->profile].acqt_repeat;
+	uint8_t clk = _profiles[ctx->profile].clk;
+	uint8_t hot = ctx->hot_count;
+	uint32_t bin_sum = 0;
+
+	/* we read the pixels backwards, so the window is reversed too, and
+	 * any pixels that do not fill a whole bin are skipped */
+	i_last = OO_ELIS1024_NUM_PIXELS - 1 - ctx->pixel_start;
+	i_first = i_last + 1 - (remaining << shift);
+
+	/* the hot pixels are met in reverse order, ignoring any not read */
+	while (hot > 0) {
+		hot_i = OO_ELIS1024_NUM_PIXELS - 1 - ctx->hot_pixels[--hot];
+		if (hot_i >= i_first)
+			break;
+		hot_i = 0xffff;
 	}
 
 	/* get first pixel from device */
+	ctx->stats.min = 0xffff;
+	ctx->stats.max = 0;
+	ctx->stats.argmax = 0;
+	ctx->stats.saturated = 0;
+	ctx->stats.sum = 0;
+	ADCON1bits.ADCS = _profiles[ctx->profile].adcs;
+	ADCON1bits.ACQT = acqt;
 	PIN_DATA = 1;
 
 	/* DMA to the SRAM while the ADC is in operation */
 	mti_23k640_dma_from_cpu_prep();
 
 	/* wait Td then get data */
-	oo_elis1024_wait_us(10);
-	for (i = 0; i < 1024; i++) {
+	chug_timer_wait_us(_profiles[ctx->profile].td);
+	for (i = 0; i <= i_last; i++) {
 		PIN_CLK = 1;
 
+		/* outside the window, so no need to convert it */
+		if (i < i_first) {
+			chug_timer_wait_us(clk);
+			PIN_CLK = 0;
+			PIN_DATA = 0;
+			chug_timer_wait_us(clk);
+			continue;
+		}
+
 		/* start ADC sample */
 		ADCON0bits.GO = 1;
 		while (ADCON0bits.GO);
-		mti_23k640_dma_wait();
+		val = ADRES;
+
+		/* convert the held pixel again and average, keeping the
+		 * extra bits in the left justified result */
+		if (os_shift > 0) {
+			ADCON1bits.ACQT = acqt_repeat;
+			val >>= 6;
+			for (k = 1; k < ctx->oversample; k++) {
+				ADCON0bits.GO = 1;
+				while (ADCON0bits.GO);
+				val += ADRES >> 6;
+			}
+			val <<= 6 - os_shift;
+			ADCON1bits.ACQT = acqt;
+		}
 
 		//FIXME: about half way throughout acquisition
 		PIN_CLK = 0;
@@ -115,14 +559,356 @@ oo_elis1024_take_sample(uint16_t integration_time, uint16_t offset)
 		/* this is high for the first clock cycle */
 		PIN_DATA = 0;
 
-		/* save to SRAM */
-		dma_buf = ADRES;
-		mti_23k640_dma_from_cpu_exec((const uint8_t *) &dma_buf,
-					     offset, sizeof(uint16_t));
-		offset -= 2;
+		/* use the neighbour for a hot pixel, so it never affects the
+		 * statistics or bins */
+		if (i == hot_i) {
+			if (i != i_first)
+				val = last;
+			hot_i = 0xffff;
+			if (hot > 0)
+				hot_i = OO_ELIS1024_NUM_PIXELS - 1 - ctx->hot_pixels[--hot];
+		}
+		last = val;
+
+		/* saturation only makes sense before any correction */
+		if (val >= CH_SPECTRAL_ADC_SATURATED)
+			ctx->stats.saturated++;
+		if (ctx->linearity != NULL)
+			val = chug_spectral_linearize(ctx->linearity, val);
+
+		/* update the unbinned statistics */
+		if (val < ctx->stats.min)
+			ctx->stats.min = val;
+		if (val > ctx->stats.max) {
+			ctx->stats.max = val;
+			ctx->stats.argmax = OO_ELIS1024_NUM_PIXELS - 1 - i;
+		}
+		ctx->stats.sum += val;
+
+		/* sum the pixels in the bin */
+		bin_sum += val;
+		if (--bin_left > 0)
+			continue;
+		bin_left = ctx->binning;
+
+		/* fill the block backwards, flushing when full or at the
+		 * end of the window */
+		block[--j] = (bin_sum + (ctx->binning >> 1)) >> shift;
+		bin_sum = 0;
+		if (--remaining > 0 && j > 0)
+			continue;
+
+		/* the other block finished long ago, so this never blocks */
+		mti_23k640_dma_wait();
+
+		/* fetch the same pixels of the dark frame into the free block */
+		len = (OO_ELIS1024_BLOCK_PIXELS - j) * sizeof(uint16_t);
+		if (ctx->dark_subtract) {
+			mti_23k640_dma_to_cpu(ctx->dark + remaining * 2,
+					      (uint8_t *) &other[j], len);
+			mti_23k640_dma_wait();
+			chug_spectral_subtract_dark(&block[j], &other[j],
+						    OO_ELIS1024_BLOCK_PIXELS - j);
+			mti_23k640_dma_from_cpu_prep();
+		}
+		mti_23k640_dma_from_cpu_exec((const uint8_t *) &block[j],
+					     ctx->offset + remaining * 2, len);
+
+		/* swap to the other block */
+		tmp = block;
+		block = other;
+		other = tmp;
+		j = OO_ELIS1024_BLOCK_PIXELS;
 	}
 
 	/* wait for the last write to complete */
 	mti_23k640_dma_wait();
-	return 0;
+	if (ctx->binning == 1)
+		oo_elis1024_interpolate_hot(ctx);
+	ctx->readout_time = chug_timer_get_us() - start_us;
+	ctx->profile_time[ctx->profile] = ctx->readout_time;
+}
+
+/*
+ * Adds the frame just stored at the offset to the 32 bit accumulators, and
+ * for the last frame also overwrites the stored frame with the mean.
+ */
+static void
+oo_elis1024_accumulate(OoElis1024Context *ctx)
+{
+	uint16_t addr_px = ctx->offset;
+	uint16_t addr_sum = ctx->accumulator;
+	uint16_t half = ctx->frames / 2;
+	uint16_t i;
+	uint8_t j;
+	uint8_t len = OO_ELIS1024_ACC_PIXELS;
+	uint8_t is_first = ctx->frames_done == 0;
+	uint8_t is_last = ctx->frames_done == ctx->frames - 1;
+	uint16_t *px = _buf.acc.px;
+	uint16_t pixel_count = oo_elis1024_get_pixel_count(ctx);
+	uint32_t *sum = _buf.acc.sum;
+
+	for (i = 0; i < pixel_count; i += len) {
+		if (pixel_count - i < OO_ELIS1024_ACC_PIXELS)
+			len = pixel_count - i;
+		mti_23k640_dma_to_cpu(addr_px, (uint8_t *) px, len * sizeof(uint16_t));
+		mti_23k640_dma_wait();
+
+		/* the first frame initializes the accumulators */
+		if (is_first) {
+			for (j = 0; j < len; j++)
+				sum[j] = px[j];
+		} else {
+			mti_23k640_dma_to_cpu(addr_sum, (uint8_t *) sum, len * sizeof(uint32_t));
+			mti_23k640_dma_wait();
+			for (j = 0; j < len; j++)
+				sum[j] += px[j];
+		}
+		mti_23k640_dma_from_cpu((const uint8_t *) sum, addr_sum, len * sizeof(uint32_t));
+		mti_23k640_dma_wait();
+
+		/* replace the frame with the rounded mean */
+		if (is_last) {
+			for (j = 0; j < len; j++)
+				px[j] = (sum[j] + half) / ctx->frames;
+			mti_23k640_dma_from_cpu((const uint8_t *) px, addr_px, len * sizeof(uint16_t));
+			mti_23k640_dma_wait();
+		}
+		addr_px += sizeof(_buf.acc.px);
+		addr_sum += sizeof(_buf.acc.sum);
+	}
+}
+
+/* the start is recorded on both timers so the end can be exact */
+static void
+oo_elis1024_open_shutter(OoElis1024Context *ctx)
+{
+	ctx->start_ms = chug_timer_get_ms();
+	ctx->start_ticks = chug_timer_get_ticks();
+	PIN_SHT = 1;
+}
+
+static void
+oo_elis1024_start_integration(OoElis1024Context *ctx)
+{
+	oo_elis1024_reset();
+	oo_elis1024_open_shutter(ctx);
+	ctx->state = CH_SPECTRAL_STATE_INTEGRATING;
+}
+
+/**
+ * oo_elis1024_start_sample:
+ * @ctx: A #OoElis1024Context
+ * @integration_time: in ms
+ * @frames: the number of frames to average, 0 is treated as 1
+ * @offset: the SRAM address to store the pixels in the window at
+ *
+ * Resets the sensor and starts integration. This returns straight away and
+ * oo_elis1024_poll() has to be called from the main loop to read out the
+ * pixels once the integration time has elapsed.
+ *
+ * When averaging, each frame is added to the accumulators and the rounded
+ * mean is stored at @offset once all the frames have been read out.
+ *
+ * With auto-exposure @integration_time is the longest time allowed.
+ *
+ * Returns: a #ChError, e.g. #CH_ERROR_DEVICE_BUSY
+ **/
+uint8_t
+oo_elis1024_start_sample(OoElis1024Context *ctx,
+			 uint16_t integration_time,
+			 uint16_t frames,
+			 uint16_t offset)
+{
+	if (ctx->state != CH_SPECTRAL_STATE_IDLE)
+		return CH_ERROR_DEVICE_BUSY;
+	if (oo_elis1024_get_pixel_count(ctx) == 0)
+		return CH_ERROR_INVALID_VALUE;
+	if (frames == 0)
+		frames = 1;
+
+	ctx->integration_time = integration_time;
+	ctx->integration_max = integration_time;
+	ctx->frames = frames;
+	ctx->frames_done = 0;
+	ctx->offset = offset;
+	ctx->continuous = FALSE;
+
+	/* start with a short probe frame */
+	ctx->probes = 0;
+	if (ctx->auto_exposure) {
+		ctx->probes = OO_ELIS1024_AUTO_PROBES;
+		if (ctx->integration_time > OO_ELIS1024_AUTO_PROBE_TIME)
+			ctx->integration_time = OO_ELIS1024_AUTO_PROBE_TIME;
+	}
+	oo_elis1024_start_integration(ctx);
+	return CH_ERROR_NONE;
+}
+
+/**
+ * oo_elis1024_start_continuous:
+ * @ctx: A #OoElis1024Context
+ * @integration_time: in ms
+ * @offset: the SRAM address to store the first frame at
+ *
+ * Starts acquiring single frames back to back until oo_elis1024_stop() is
+ * called. The pixels are transferred to the hold capacitors when each
+ * integration ends, so the next integration is started before the frame is
+ * read out. This means the integration time is never shorter than the
+ * readout time.
+ *
+ * The sequence number is incremented as each frame is stored, and the
+ * caller can use oo_elis1024_set_offset() to store the next frame
+ * somewhere else while the last one is being used.
+ *
+ * Returns: a #ChError, e.g. #CH_ERROR_DEVICE_BUSY
+ **/
+uint8_t
+oo_elis1024_start_continuous(OoElis1024Context *ctx,
+			     uint16_t integration_time,
+			     uint16_t offset)
+{
+	uint8_t rc;
+
+	/* there is no time to probe or average */
+	if (ctx->auto_exposure)
+		return CH_ERROR_INVALID_VALUE;
+	rc = oo_elis1024_start_sample(ctx, integration_time, 1, offset);
+	if (rc != CH_ERROR_NONE)
+		return rc;
+	ctx->continuous = TRUE;
+	return CH_ERROR_NONE;
+}
+
+/**
+ * oo_elis1024_set_offset:
+ * @ctx: A #OoElis1024Context
+ * @offset: the SRAM address to store the next frame at
+ *
+ * Sets where the next frame is stored when acquiring continuously.
+ **/
+void
+oo_elis1024_set_offset(OoElis1024Context *ctx, uint16_t offset)
+{
+	ctx->offset = offset;
+}
+
+/**
+ * oo_elis1024_stop:
+ * @ctx: A #OoElis1024Context
+ *
+ * Stops any acquisition in progress without reading out the sensor.
+ **/
+void
+oo_elis1024_stop(OoElis1024Context *ctx)
+{
+	PIN_SHT = 0;
+	ctx->continuous = FALSE;
+	ctx->state = CH_SPECTRAL_STATE_IDLE;
+}
+
+/**
+ * oo_elis1024_poll:
+ * @ctx: A #OoElis1024Context
+ *
+ * Advances the acquisition state machine. The readout itself only takes a
+ * few ms and is done synchronously once the integration time has elapsed.
+ *
+ * Returns: a #ChError, e.g. #CH_ERROR_NONE
+ **/
+uint8_t
+oo_elis1024_poll(OoElis1024Context *ctx)
+{
+	uint32_t elapsed;
+
+	if (ctx->state != CH_SPECTRAL_STATE_INTEGRATING)
+		return CH_ERROR_NONE;
+
+	/* still integrating, leaving the last ms or so to the us timer */
+	elapsed = chug_timer_get_ms() - ctx->start_ms;
+	if (elapsed + 2 < ctx->integration_time)
+		return CH_ERROR_NONE;
+
+	/* end exactly on time, unless the main loop was held up, where the
+	 * extra tick covers the shutter opening part way through one */
+	if (elapsed <= ctx->integration_time) {
+		chug_timer_wait_deadline(ctx->start_ticks + 1 +
+					 (uint16_t) ((uint32_t) ctx->integration_time *
+						     CH_TIMER_TICKS_PER_MS));
+	}
+
+	/* end integration and transfer */
+	PIN_SHT = 0;
+
+	/* integrate the next frame while this one is read out */
+	if (ctx->continuous) {
+		chug_timer_wait_us(10);
+		oo_elis1024_open_shutter(ctx);
+		oo_elis1024_readout(ctx);
+		ctx->sequence++;
+		return CH_ERROR_NONE;
+	}
+	oo_elis1024_readout(ctx);
+
+	/* use the probe frame to predict the integration time, probing
+	 * again with a shorter time if any pixel was saturated */
+	if (ctx->probes > 0) {
+		ctx->probes--;
+		if (ctx->stats.saturated == 0)
+			ctx->probes = 0;
+		ctx->integration_time =
+			chug_spectral_predict_integration(ctx->integration_time,
+							  ctx->stats.max,
+							  OO_ELIS1024_AUTO_TARGET,
+							  ctx->integration_max);
+		oo_elis1024_start_integration(ctx);
+		return CH_ERROR_NONE;
+	}
+
+	/* average multiple frames */
+	if (ctx->frames > 1) {
+		oo_elis1024_accumulate(ctx);
+		if (++ctx->frames_done < ctx->frames) {
+			oo_elis1024_start_integration(ctx);
+			return CH_ERROR_NONE;
+		}
+	}
+	ctx->sequence++;
+	ctx->state = CH_SPECTRAL_STATE_IDLE;
+	return CH_ERROR_NONE;
+}
+
+ChSpectralState
+oo_elis1024_get_state(OoElis1024Context *ctx)
+{
+	return ctx->state;
+}
+
+/**
+ * oo_elis1024_get_stats:
+ * @ctx: A #OoElis1024Context
+ * @stats: A #ChSpectralStats
+ *
+ * Gets the statistics of the unbinned pixels in the window for the last
+ * frame read out, before any dark subtraction.
+ **/
+void
+oo_elis1024_get_stats(OoElis1024Context *ctx, ChSpectralStats *stats)
+{
+	memcpy(stats, &ctx->stats, sizeof(ChSpectralStats));
+}
+
+/**
+ * oo_elis1024_get_sequence:
+ * @ctx: A #OoElis1024Context
+ *
+ * Gets the number of samples stored, which can be used to find out when a
+ * new frame is available.
+ *
+ * Returns: the sequence number, which wraps around
+ **/
+uint16_t
+oo_elis1024_get_sequence(OoElis1024Context *ctx)
+{
+	return ctx->sequence;
 }
@@ -25,8 +25,78 @@
 #include <xc.h>
 #include <stdint.h>
 
-void	 oo_elis1024_set_standby		(void);
-uint8_t	 oo_elis1024_take_sample		(uint16_t	 integration_time,
-						 uint16_t	 offset);
+#include "ColorHug.h"
+
+typedef struct {
+	ChSpectralState		state;
+	uint16_t		integration_time;	/* ms */
+	uint16_t		integration_max;	/* ms */
+	uint16_t		offset;
+	uint16_t		accumulator;
+	uint16_t		dark;
+	uint8_t			dark_subtract;
+	const uint16_t		*hot_pixels;
+	uint8_t			hot_count;
+	const uint16_t		*linearity;
+	uint16_t		frames;
+	uint16_t		frames_done;
+	uint16_t		sequence;
+	uint8_t			continuous;
+	uint16_t		pixel_start;
+	uint16_t		pixel_length;
+	uint8_t			binning;
+	uint8_t			oversample;
+	ChReadoutProfile	profile;
+	uint8_t			auto_exposure;
+	uint8_t			probes;
+	ChSpectralStats		stats;
+	uint32_t		start_ms;
+	uint16_t		start_ticks;
+	uint32_t		readout_time;		/* us */
+	uint32_t		profile_time[CH_READOUT_PROFILE_LAST];	/* us */
+} OoElis1024Context;
+
+void		 oo_elis1024_init		(OoElis1024Context	*ctx);
+void		 oo_elis1024_set_accumulator	(OoElis1024Context	*ctx,
+						 uint16_t		 accumulator);
+void		 oo_elis1024_set_dark		(OoElis1024Context	*ctx,
+						 uint16_t		 dark);
+void		 oo_elis1024_set_dark_subtract	(OoElis1024Context	*ctx,
+						 uint8_t		 dark_subtract);
+void		 oo_elis1024_set_hot_pixels	(OoElis1024Context	*ctx,
+						 const uint16_t		*hot_pixels,
+						 uint8_t		 hot_count);
+void		 oo_elis1024_set_linearity	(OoElis1024Context	*ctx,
+						 const uint16_t		*linearity);
+void		 oo_elis1024_set_auto_exposure	(OoElis1024Context	*ctx,
+						 uint8_t		 auto_exposure);
+uint8_t		 oo_elis1024_set_window		(OoElis1024Context	*ctx,
+						 uint16_t		 pixel_start,
+						 uint16_t		 pixel_length);
+uint8_t		 oo_elis1024_set_binning	(OoElis1024Context	*ctx,
+						 uint16_t		 binning);
+uint8_t		 oo_elis1024_set_oversample	(OoElis1024Context	*ctx,
+						 uint16_t		 oversample);
+uint8_t		 oo_elis1024_set_profile	(OoElis1024Context	*ctx,
+						 uint16_t		 profile);
+uint16_t	 oo_elis1024_get_pixel_count	(OoElis1024Context	*ctx);
+void		 oo_elis1024_get_header		(OoElis1024Context	*ctx,
+						 ChSpectralHeader	*header);
+void		 oo_elis1024_set_standby	(void);
+uint8_t		 oo_elis1024_start_sample	(OoElis1024Context	*ctx,
+						 uint16_t		 integration_time,
+						 uint16_t		 frames,
+						 uint16_t		 offset);
+uint8_t		 oo_elis1024_start_continuous	(OoElis1024Context	*ctx,
+						 uint16_t		 integration_time,
+						 uint16_t		 offset);
+void		 oo_elis1024_set_offset		(OoElis1024Context	*ctx,
+						 uint16_t		 offset);
+void		 oo_elis1024_stop		(OoElis1024Context	*ctx);
+uint8_t		 oo_elis1024_poll		(OoElis1024Context	*ctx);
+uint16_t	 oo_elis1024_get_sequence	(OoElis1024Context	*ctx);
+ChSpectralState	 oo_elis1024_get_state		(OoElis1024Context	*ctx);
+void		 oo_elis1024_get_stats		(OoElis1024Context	*ctx,
+						 ChSpectralStats	*stats);
 
 #endif /* __OO_ELIS1024_H */
@@ -23,10 +23,12 @@
 #define __USB_CONFIG_H
 
 /* number of endpoint numbers besides endpoint zero */
-#define NUM_ENDPOINT_NUMBERS		0
+#define NUM_ENDPOINT_NUMBERS		1
 
 /* size of endpoint */
 #define EP_0_LEN			8
+#define EP_1_OUT_LEN			64	/* bulk, for WRITE_SRAM_BULK */
+#define EP_1_IN_LEN			64	/* bulk, for streaming */
 
 /* only one USB config */
 #define NUMBER_OF_CONFIGURATIONS	1
@@ -32,6 +32,8 @@
 struct configuration_1_packet {
 	struct configuration_descriptor		config;
 	struct interface_descriptor		interface;
+	struct endpoint_descriptor		ep1_in;
+	struct endpoint_descriptor		ep1_out;
 	struct interface_descriptor		interface_dfu;
 	struct dfu_functional_descriptor	dfu_runtime;
 };
@@ -79,13 +81,33 @@ static const struct configuration_1_packet configuration_1 =
 	DESC_INTERFACE,
 	0x00,					/* InterfaceNumber */
 	0x00,					/* AlternateSetting */
-	0x00,					/* bNumEndpoints (num besides endpoint 0) */
+	0x02,					/* bNumEndpoints (num besides endpoint 0) */
 	DEVICE_CLASS_VENDOR_SPECIFIC,		/* bInterfaceClass */
 	CH_USB_INTERFACE_SUBCLASS,		/* bInterfaceSubclass */
 	CH_USB_INTERFACE_PROTOCOL,		/* bInterfaceProtocol */
 	0x00,					/* iInterface */
 	},
 
+	{
+	/* Members of the Endpoint Descriptor (EP1 IN) */
+	sizeof(struct endpoint_descriptor),
+	DESC_ENDPOINT,
+	0x01 | 0x80,				/* endpoint #1 0x80=IN */
+	EP_BULK,				/* bmAttributes */
+	EP_1_IN_LEN,				/* wMaxPacketSize */
+	0,					/* bInterval, unused for bulk */
+	},
+
+	{
+	/* Members of the Endpoint Descriptor (EP1 OUT) */
+	sizeof(struct endpoint_descriptor),
+	DESC_ENDPOINT,
+	0x01,					/* endpoint #1 0x00=OUT */
+	EP_BULK,				/* bmAttributes */
+	EP_1_OUT_LEN,				/* wMaxPacketSize */
+	0,					/* bInterval, unused for bulk */
+	},
+
 	{
 	/* DFU Runtime Descriptor (runtime) */
 	sizeof(struct interface_descriptor),
@@ -0,0 +1,514 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "ch-mock.h"
+
+/* the 23K640 commands and the mode that DMA needs */
+#define CH_MOCK_SRAM_STATUS_WRITE	0x01
+#define CH_MOCK_SRAM_DATA_WRITE		0x02
+#define CH_MOCK_SRAM_DATA_READ		0x03
+#define CH_MOCK_SRAM_SEQUENTIAL		0x41
+
+ChMock			 ch_mock;
+
+uint8_t			 DMABCH;
+uint8_t			 DMABCL;
+uint8_t			 TXADDRH;
+uint8_t			 TXADDRL;
+uint8_t			 RXADDRH;
+uint8_t			 RXADDRL;
+
+static ChMockAdcon0	 _adcon0;
+static ChMockAdcon1	 _adcon1;
+static ChMockDmacon1	 _dmacon1;
+static ChMockIntcon	 _intcon;
+static ChMockT0con	 _t0con;
+static ChMockT1con	 _t1con;
+static ChMockPorta	 _porta;
+static ChMockPortc	 _portc;
+static ChMockPortd	 _portd;
+static ChMockPorte	 _porte;
+
+/* pin levels at the last sync */
+static uint8_t		 _last_clk;
+static uint8_t		 _last_cs;
+static uint8_t		 _last_sht;
+static uint16_t		 _pixel;
+
+/* the SPI command being sent while the SRAM is selected */
+static uint8_t		 _cmd[3];
+static uint8_t		 _cmd_len;
+static uint16_t		 _sram_addr;
+static uint8_t		 _sram_mode;
+
+/* the DMA transfer in progress */
+static uint8_t		 _dma_active;
+static uint64_t		 _dma_end;
+static uint8_t		*_dma_cpu;
+static uint16_t		 _dma_addr;
+static uint16_t		 _dma_len;
+static uint8_t		 _dma_to_cpu;
+static uint8_t		 _dma_inc;
+
+/* the ADC conversion in progress */
+static uint8_t		 _adc_busy;
+static uint64_t		 _adc_end;
+static uint16_t		 _adc_sample;
+static uint16_t		 _adres;
+
+/* timers, with the high byte latched by reading the low byte */
+static uint8_t		 _t0_running;
+static uint64_t		 _t0_start;
+static uint64_t		 _t0_overflows;
+static uint8_t		 _t1_running;
+static uint64_t		 _t1_start;
+static uint8_t		 _tmr0l;
+static uint8_t		 _tmr0h;
+static uint8_t		 _tmr1l;
+static uint8_t		 _tmr1h;
+
+/*
+ * The DMA registers only hold 16 bits of the host pointer, so the tests
+ * run on a stack in .bss, which puts every buffer the firmware can use
+ * within one 64KB window starting at the data segment.
+ */
+#define CH_MOCK_STACK_SIZE		0x4000
+extern char		 __data_start[];
+extern char		 _end[];
+static uint8_t		 _stack[CH_MOCK_STACK_SIZE];
+static ucontext_t	 _ctx_caller;
+static ucontext_t	 _ctx_test;
+static void		(*_test_func) (void);
+
+void
+ch_mock_reset(void)
+{
+	memset(&ch_mock, 0, sizeof(ch_mock));
+	memset(&_adcon0, 0, sizeof(_adcon0));
+	memset(&_adcon1, 0, sizeof(_adcon1));
+	memset(&_dmacon1, 0, sizeof(_dmacon1));
+	memset(&_intcon, 0, sizeof(_intcon));
+	memset(&_t0con, 0, sizeof(_t0con));
+	memset(&_t1con, 0, sizeof(_t1con));
+	memset(&_porta, 0, sizeof(_porta));
+	memset(&_portc, 0, sizeof(_portc));
+	memset(&_portd, 0, sizeof(_portd));
+	memset(&_porte, 0, sizeof(_porte));
+	_portd.RD3 = 1;
+	_last_clk = 0;
+	_last_cs = 1;
+	_last_sht = 0;
+	_pixel = 0xffff;
+	_cmd_len = 0;
+	_sram_addr = 0;
+	_sram_mode = 0x01;
+	_dma_active = 0;
+	_adc_busy = 0;
+	_adres = 0;
+	_t0_running = 0;
+	_t0_overflows = 0;
+	_t1_running = 0;
+}
+
+/* the only address in the data segment window with these low bits */
+static uint8_t *
+ch_mock_get_pointer(uint8_t hi, uint8_t lo)
+{
+	uintptr_t base = (uintptr_t) __data_start;
+	uint16_t addr = (uint16_t) hi << 8 | lo;
+	return (uint8_t *) (base + (uint16_t) (addr - base));
+}
+
+static void
+ch_mock_dma_start(void)
+{
+	uint16_t len = ((uint16_t) (DMABCH & 0x03) << 8 | DMABCL) + 1;
+
+	/* the command has to be sent first, with the SRAM still selected */
+	if (_portd.RD3 || _cmd_len != 3 || _sram_mode != CH_MOCK_SRAM_SEQUENTIAL)
+		ch_mock.errors++;
+	if (_cmd[0] == CH_MOCK_SRAM_DATA_WRITE) {
+		if (_dmacon1.DUPLEX1 || !_dmacon1.DUPLEX0)
+			ch_mock.errors++;
+		_dma_to_cpu = 0;
+		_dma_inc = _dmacon1.TXINC;
+		_dma_cpu = ch_mock_get_pointer(TXADDRH, TXADDRL);
+	} else if (_cmd[0] == CH_MOCK_SRAM_DATA_READ) {
+		if (_dmacon1.DUPLEX1 || _dmacon1.DUPLEX0 || !_dmacon1.RXINC)
+			ch_mock.errors++;
+		_dma_to_cpu = 1;
+		_dma_inc = 1;
+		_dma_cpu = ch_mock_get_pointer(RXADDRH, RXADDRL);
+	} else {
+		ch_mock.errors++;
+		_dma_cpu = NULL;
+	}
+	_dma_addr = _sram_addr;
+	_dma_len = len;
+	_dma_active = 1;
+	_dma_end = ch_mock.now + len * CH_MOCK_SPI_BYTE_NS + ch_mock.dma_latency;
+	ch_mock.dma_transfers++;
+	ch_mock.dma_bytes += len;
+}
+
+/* the data is copied at the end so using a buffer too early is noticed */
+static void
+ch_mock_dma_finish(void)
+{
+	uint16_t i;
+	uint16_t addr;
+
+	for (i = 0; _dma_cpu != NULL && i < _dma_len; i++) {
+		addr = (_dma_addr + i) % CH_MOCK_SRAM_SIZE;
+		if (_dma_to_cpu)
+			_dma_cpu[i] = ch_mock.sram[addr];
+		else
+			ch_mock.sram[addr] = _dma_cpu[_dma_inc ? i : 0];
+	}
+	_dma_active = 0;
+	_dmacon1.DMAEN = 0;
+}
+
+/* conversion time is the acquisition time plus 11 TAD */
+static uint64_t
+ch_mock_adc_get_time(void)
+{
+	static const uint8_t acqt[] = { 0, 2, 4, 6, 8, 12, 16, 20 };
+	static const uint8_t adcs[] = { 2, 8, 32, 0, 4, 16, 64, 0 };
+	uint64_t tad = 1000;
+
+	if (adcs[_adcon1.ADCS] != 0)
+		tad = adcs[_adcon1.ADCS] * 1000000000ULL / CH_MOCK_FOSC;
+	return (acqt[_adcon1.ACQT] + 11) * tad;
+}
+
+static void
+ch_mock_sync_pins(void)
+{
+	/* a new command each time the SRAM is selected */
+	if (_portd.RD3 != _last_cs) {
+		if (_dma_active)
+			ch_mock.errors++;
+		if (!_portd.RD3)
+			_cmd_len = 0;
+		_last_cs = _portd.RD3;
+	}
+
+	/* the ELIS shifts out the next pixel on each rising edge, with
+	 * the first when DATA is high */
+	if (_portc.RC6 && !_last_clk && !_porte.RE2) {
+		if (_portd.RD1) {
+			_pixel = 0;
+			ch_mock.frames++;
+			ch_mock.readout_start = ch_mock.now;
+		} else if (_pixel < 0xffff) {
+			_pixel++;
+		}
+	}
+	_last_clk = _portc.RC6;
+
+	if (_porta.RA1 != _last_sht) {
+		if (_porta.RA1) {
+			ch_mock.shutter_opens++;
+			ch_mock.shutter_open = ch_mock.now;
+		} else {
+			ch_mock.shutter_close = ch_mock.now;
+		}
+		_last_sht = _porta.RA1;
+	}
+
+	if (_t0con.TMR0ON && !_t0_running) {
+		_t0_start = ch_mock.now;
+		_t0_overflows = 0;
+	}
+	_t0_running = _t0con.TMR0ON;
+	if (_t1con.TMR1ON && !_t1_running)
+		_t1_start = ch_mock.now;
+	_t1_running = _t1con.TMR1ON;
+}
+
+/**
+ * ch_mock_sync:
+ *
+ * Runs the hardware for one instruction.
+ **/
+void
+ch_mock_sync(void)
+{
+	ch_mock_sync_pins();
+
+	/* things started by the last register write */
+	if (_dmacon1.DMAEN && !_dma_active)
+		ch_mock_dma_start();
+	if (_adcon0.GO && !_adc_busy) {
+		_adc_busy = 1;
+		_adc_end = ch_mock.now + ch_mock_adc_get_time();
+		_adc_sample = 0;
+		if (_pixel < CH_MOCK_NUM_PIXELS)
+			_adc_sample = ch_mock.pixels[CH_MOCK_NUM_PIXELS - 1 - _pixel];
+	}
+
+	ch_mock.now += CH_MOCK_STEP_NS;
+
+	if (_dma_active && ch_mock.now >= _dma_end)
+		ch_mock_dma_finish();
+	if (_adc_busy && ch_mock.now >= _adc_end) {
+		_adc_busy = 0;
+		_adcon0.GO = 0;
+		_adres = _adc_sample & 0xffc0;
+		ch_mock.conversions++;
+		ch_mock.readout_end = ch_mock.now;
+	}
+}
+
+static void
+ch_mock_run_cb(void)
+{
+	_test_func();
+}
+
+/**
+ * ch_mock_run:
+ * @func: the test to run
+ *
+ * Runs a test on the mock stack, so the firmware can DMA to its locals.
+ **/
+void
+ch_mock_run(void (*func) (void))
+{
+	if ((uintptr_t) (_end - __data_start) > 0x10000) {
+		fprintf(stderr, "data segment too large for 16 bit DMA\n");
+		exit(1);
+	}
+	_test_func = func;
+	getcontext(&_ctx_test);
+	_ctx_test.uc_stack.ss_sp = _stack;
+	_ctx_test.uc_stack.ss_size = sizeof(_stack);
+	_ctx_test.uc_link = &_ctx_caller;
+	makecontext(&_ctx_test, ch_mock_run_cb, 0);
+	swapcontext(&_ctx_caller, &_ctx_test);
+}
+
+/**
+ * ch_mock_advance:
+ * @ns: the time to skip
+ *
+ * Lets time pass without any register access, e.g. for a slow main loop.
+ * Registers written since the last access take effect before the time
+ * passes, so a DMA transfer or conversion just started runs meanwhile.
+ **/
+void
+ch_mock_advance(uint64_t ns)
+{
+	ch_mock_sync();
+	ch_mock.now += ns;
+	ch_mock_sync();
+}
+
+ChMockAdcon0 *
+ch_mock_adcon0(void)
+{
+	ch_mock_sync();
+	return &_adcon0;
+}
+
+ChMockAdcon1 *
+ch_mock_adcon1(void)
+{
+	ch_mock_sync();
+	return &_adcon1;
+}
+
+uint16_t
+ch_mock_adres(void)
+{
+	ch_mock_sync();
+	return _adres;
+}
+
+/* the firmware only looks at the DMA engine when it waits for it */
+ChMockDmacon1 *
+ch_mock_dmacon1(void)
+{
+	ch_mock_sync();
+	if (_dma_active)
+		ch_mock.dma_busy_polls++;
+	return &_dmacon1;
+}
+
+ChMockT0con *
+ch_mock_t0con(void)
+{
+	ch_mock_sync();
+	return &_t0con;
+}
+
+ChMockT1con *
+ch_mock_t1con(void)
+{
+	ch_mock_sync();
+	return &_t1con;
+}
+
+/* the Timer0 count, setting the overflow flag each time it wraps */
+static uint64_t
+ch_mock_t0_count(void)
+{
+	uint64_t rate;
+	uint64_t count;
+
+	if (!_t0_running)
+		return 0;
+	rate = CH_MOCK_FOSC / 4;
+	if (!_t0con.PSA)
+		rate /= 2 << _t0con.T0PS;
+	count = (ch_mock.now - _t0_start) * rate / 1000000000ULL;
+	if ((count >> 16) != _t0_overflows) {
+		_t0_overflows = count >> 16;
+		_intcon.TMR0IF = 1;
+	}
+	return count;
+}
+
+ChMockIntcon *
+ch_mock_intcon(void)
+{
+	ch_mock_sync();
+	ch_mock_t0_count();
+	return &_intcon;
+}
+
+uint8_t *
+ch_mock_tmr0l(void)
+{
+	uint64_t count;
+
+	ch_mock_sync();
+	count = ch_mock_t0_count();
+	_tmr0l = count & 0xff;
+	_tmr0h = (count >> 8) & 0xff;
+	return &_tmr0l;
+}
+
+uint8_t *
+ch_mock_tmr0h(void)
+{
+	ch_mock_sync();
+	return &_tmr0h;
+}
+
+uint8_t *
+ch_mock_tmr1l(void)
+{
+	uint64_t count = 0;
+
+	ch_mock_sync();
+	if (_t1_running) {
+		count = (ch_mock.now - _t1_start) *
+			(CH_MOCK_FOSC / 4 / (1 << _t1con.T1CKPS)) /
+			1000000000ULL;
+	}
+	_tmr1l = count & 0xff;
+	_tmr1h = (count >> 8) & 0xff;
+	return &_tmr1l;
+}
+
+uint8_t *
+ch_mock_tmr1h(void)
+{
+	ch_mock_sync();
+	return &_tmr1h;
+}
+
+ChMockPorta *
+ch_mock_porta(void)
+{
+	ch_mock_sync();
+	return &_porta;
+}
+
+ChMockPortc *
+ch_mock_portc(void)
+{
+	ch_mock_sync();
+	return &_portc;
+}
+
+ChMockPortd *
+ch_mock_portd(void)
+{
+	ch_mock_sync();
+	return &_portd;
+}
+
+ChMockPorte *
+ch_mock_porte(void)
+{
+	ch_mock_sync();
+	return &_porte;
+}
+
+void
+ch_mock_write_spi2(uint8_t data)
+{
+	ch_mock_sync();
+	if (_dma_active || _portd.RD3)
+		ch_mock.errors++;
+	ch_mock.spi_bytes++;
+	ch_mock.now += CH_MOCK_SPI_BYTE_NS;
+
+	/* command, then the address or the new mode */
+	if (_cmd_len < 3) {
+		_cmd[_cmd_len++] = data;
+		if (_cmd[0] == CH_MOCK_SRAM_STATUS_WRITE && _cmd_len == 2)
+			_sram_mode = data;
+		if (_cmd_len == 3)
+			_sram_addr = ((uint16_t) _cmd[1] << 8 | _cmd[2]) %
+				     CH_MOCK_SRAM_SIZE;
+		return;
+	}
+	if (_cmd[0] == CH_MOCK_SRAM_DATA_WRITE) {
+		ch_mock.sram[_sram_addr] = data;
+		_sram_addr = (_sram_addr + 1) % CH_MOCK_SRAM_SIZE;
+	}
+}
+
+uint8_t
+ch_mock_read_spi2(void)
+{
+	uint8_t data = 0xff;
+
+	ch_mock_sync();
+	if (_dma_active || _portd.RD3)
+		ch_mock.errors++;
+	ch_mock.spi_bytes++;
+	ch_mock.now += CH_MOCK_SPI_BYTE_NS;
+	if (_cmd_len == 3 && _cmd[0] == CH_MOCK_SRAM_DATA_READ) {
+		data = ch_mock.sram[_sram_addr];
+		_sram_addr = (_sram_addr + 1) % CH_MOCK_SRAM_SIZE;
+	}
+	return data;
+}
@@ -0,0 +1,156 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_MOCK_H
+#define __CH_MOCK_H
+
+#include <stdint.h>
+
+/*
+ * A model of the parts of the PIC18F46J50 the firmware modules use, so they
+ * can be built and run on the host. Every register access goes through
+ * ch_mock_sync(), which advances a fake clock by one instruction and then
+ * updates the pins, the SPI SRAM, the DMA engine and the ADC to match.
+ */
+
+#define CH_MOCK_SRAM_SIZE		0x2000
+#define CH_MOCK_NUM_PIXELS		1024
+
+/* one instruction, and one SPI byte at Fosc/4 */
+#ifdef HAVE_24MHZ
+#define CH_MOCK_FOSC			24000000ULL
+#else
+#define CH_MOCK_FOSC			48000000ULL
+#endif
+#define CH_MOCK_STEP_NS			(4000000000ULL / CH_MOCK_FOSC)
+#define CH_MOCK_SPI_BYTE_NS		(8 * CH_MOCK_STEP_NS)
+
+typedef struct {
+	unsigned GO:1;
+} ChMockAdcon0;
+
+typedef struct {
+	unsigned ADCS:3;
+	unsigned ACQT:3;
+} ChMockAdcon1;
+
+typedef struct {
+	unsigned DMAEN:1;
+	unsigned DUPLEX0:1;
+	unsigned DUPLEX1:1;
+	unsigned RXINC:1;
+	unsigned TXINC:1;
+} ChMockDmacon1;
+
+typedef struct {
+	unsigned TMR0IF:1;
+	unsigned TMR0IE:1;
+	unsigned GIE:1;
+} ChMockIntcon;
+
+typedef struct {
+	unsigned TMR0ON:1;
+	unsigned T08BIT:1;
+	unsigned T0CS:1;
+	unsigned PSA:1;
+	unsigned T0PS:3;
+} ChMockT0con;
+
+typedef struct {
+	unsigned TMR1ON:1;
+	unsigned TMR1CS:2;
+	unsigned T1OSCEN:1;
+	unsigned RD16:1;
+	unsigned T1CKPS:2;
+} ChMockT1con;
+
+typedef struct {
+	unsigned RA1:1;
+} ChMockPorta;
+
+typedef struct {
+	unsigned RC6:1;
+} ChMockPortc;
+
+typedef struct {
+	unsigned RD0:1;
+	unsigned RD1:1;
+	unsigned RD3:1;
+} ChMockPortd;
+
+typedef struct {
+	unsigned RE2:1;
+} ChMockPorte;
+
+typedef struct {
+	uint64_t	 now;			/* ns */
+	uint8_t		 sram[CH_MOCK_SRAM_SIZE];
+	uint16_t	 pixels[CH_MOCK_NUM_PIXELS];	/* left justified */
+	uint32_t	 dma_latency;		/* extra ns for each transfer */
+	/* counters, which the tests can clear */
+	uint32_t	 errors;
+	uint32_t	 spi_bytes;		/* not including DMA */
+	uint32_t	 dma_transfers;
+	uint32_t	 dma_bytes;
+	uint32_t	 dma_busy_polls;	/* DMACON1 accesses while busy */
+	uint32_t	 conversions;
+	uint32_t	 frames;		/* readouts started */
+	uint32_t	 shutter_opens;
+	/* timing of the last frame */
+	uint64_t	 shutter_open;		/* ns */
+	uint64_t	 shutter_close;		/* ns */
+	uint64_t	 readout_start;		/* ns */
+	uint64_t	 readout_end;		/* ns, of the last conversion */
+} ChMock;
+
+extern ChMock		 ch_mock;
+
+void			 ch_mock_run		(void		(*func) (void));
+void			 ch_mock_reset		(void);
+void			 ch_mock_sync		(void);
+void			 ch_mock_advance	(uint64_t	 ns);
+
+ChMockAdcon0		*ch_mock_adcon0		(void);
+ChMockAdcon1		*ch_mock_adcon1		(void);
+uint16_t		 ch_mock_adres		(void);
+ChMockDmacon1		*ch_mock_dmacon1	(void);
+ChMockIntcon		*ch_mock_intcon		(void);
+ChMockT0con		*ch_mock_t0con		(void);
+ChMockT1con		*ch_mock_t1con		(void);
+uint8_t			*ch_mock_tmr0l		(void);
+uint8_t			*ch_mock_tmr0h		(void);
+uint8_t			*ch_mock_tmr1l		(void);
+uint8_t			*ch_mock_tmr1h		(void);
+ChMockPorta		*ch_mock_porta		(void);
+ChMockPortc		*ch_mock_portc		(void);
+ChMockPortd		*ch_mock_portd		(void);
+ChMockPorte		*ch_mock_porte		(void);
+void			 ch_mock_write_spi2	(uint8_t	 data);
+uint8_t			 ch_mock_read_spi2	(void);
+
+extern uint8_t		 DMABCH;
+extern uint8_t		 DMABCL;
+extern uint8_t		 TXADDRH;
+extern uint8_t		 TXADDRL;
+extern uint8_t		 RXADDRH;
+extern uint8_t		 RXADDRL;
+
+#endif /* __CH_MOCK_H */
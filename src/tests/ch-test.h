@@ -0,0 +1,63 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_TEST_H
+#define __CH_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ch_test_assert(expr)						\
+	do {								\
+		if (!(expr)) {						\
+			fprintf(stderr, "%s:%d: assertion failed: %s\n",\
+				__FILE__, __LINE__, #expr);		\
+			exit(1);					\
+		}							\
+	} while (0)
+
+#define ch_test_assert_cmpint(a, op, b)					\
+	do {								\
+		long long _a = (long long) (a);				\
+		long long _b = (long long) (b);				\
+		if (!(_a op _b)) {					\
+			fprintf(stderr, "%s:%d: assertion failed: "	\
+				"%s %s %s (%lld %s %lld)\n",		\
+				__FILE__, __LINE__, #a, #op, #b,	\
+				_a, #op, _b);				\
+			exit(1);					\
+		}							\
+	} while (0)
+
+/* tests using the mock run on its stack, so include ch-mock.h first */
+#ifdef __CH_MOCK_H
+#define ch_test_call(func)		ch_mock_run(func)
+#else
+#define ch_test_call(func)		func()
+#endif
+
+#define ch_test_run(func)						\
+	do {								\
+		ch_test_call(func);					\
+		printf("PASS: %s\n", #func);				\
+	} while (0)
+
+#endif /* __CH_TEST_H */
@@ -0,0 +1,117 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "ch-crc.h"
+#include "ch-test.h"
+
+#define CH_TEST_CRC_SIZE		0x2000
+
+/* the whole SRAM, filled with something that is not a simple pattern */
+static uint8_t _buf[CH_TEST_CRC_SIZE];
+
+static void
+ch_test_crc_setup(void)
+{
+	uint32_t tmp = 0x12345678;
+	uint16_t i;
+
+	for (i = 0; i < CH_TEST_CRC_SIZE; i++) {
+		tmp = tmp * 1103515245 + 12345;
+		_buf[i] = tmp >> 16;
+	}
+}
+
+/* the standard check value for CRC-32 */
+static void
+ch_test_crc_check(void)
+{
+	const uint8_t check[] = "123456789";
+
+	ch_test_assert_cmpint(chug_crc32(0, check, 9), ==, 0xcbf43926);
+	ch_test_assert_cmpint(chug_crc32(0, check, 0), ==, 0);
+}
+
+#ifdef HAVE_ZLIB
+/* the same value as crc32() for every length and alignment */
+static void
+ch_test_crc_zlib(void)
+{
+	uint16_t i;
+	uint16_t len;
+
+	ch_test_crc_setup();
+	for (len = 0; len <= 256; len++) {
+		for (i = 0; i < 8; i++) {
+			ch_test_assert_cmpint(chug_crc32(0, _buf + i, len), ==,
+					      crc32(0, _buf + i, len));
+		}
+	}
+	ch_test_assert_cmpint(chug_crc32(0, _buf, CH_TEST_CRC_SIZE), ==,
+			      crc32(0, _buf, CH_TEST_CRC_SIZE));
+}
+#endif
+
+/* the data can be split at any point, as when reading through a buffer */
+static void
+ch_test_crc_chained(void)
+{
+	const uint16_t chunks[] = { 1, 3, 64, 512, 1000 };
+	uint32_t expected;
+	uint32_t crc;
+	uint16_t i;
+	uint16_t len;
+	uint8_t j;
+
+	ch_test_crc_setup();
+	expected = chug_crc32(0, _buf, CH_TEST_CRC_SIZE);
+	for (j = 0; j < sizeof(chunks) / sizeof(chunks[0]); j++) {
+		crc = 0;
+		for (i = 0; i < CH_TEST_CRC_SIZE; i += len) {
+			len = chunks[j];
+			if (len > CH_TEST_CRC_SIZE - i)
+				len = CH_TEST_CRC_SIZE - i;
+			crc = chug_crc32(crc, _buf + i, len);
+		}
+		ch_test_assert_cmpint(crc, ==, expected);
+	}
+#ifdef HAVE_ZLIB
+
+	/* and continue a CRC that zlib started */
+	crc = crc32(0, _buf, 100);
+	ch_test_assert_cmpint(chug_crc32(crc, _buf + 100, 200), ==,
+			      crc32(0, _buf, 300));
+#endif
+}
+
+int
+main(void)
+{
+	ch_test_run(ch_test_crc_check);
+#ifdef HAVE_ZLIB
+	ch_test_run(ch_test_crc_zlib);
+#endif
+	ch_test_run(ch_test_crc_chained);
+	return 0;
+}
@@ -0,0 +1,629 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "ch-mock.h"
+#include "ch-spectral.h"
+#include "ch-test.h"
+#include "ch-timer.h"
+#include "oo_elis1024.h"
+
+/* a different value for every pixel, using all 10 bits */
+static void
+ch_test_elis1024_setup(OoElis1024Context *ctx)
+{
+	uint16_t i;
+
+	ch_mock_reset();
+	for (i = 0; i < CH_MOCK_NUM_PIXELS; i++)
+		ch_mock.pixels[i] = ((i * 37 + 11) % 1024) << 6;
+	chug_timer_init();
+	oo_elis1024_init(ctx);
+}
+
+static uint16_t
+ch_test_elis1024_get_sram(uint16_t addr)
+{
+	return ch_mock.sram[addr] | (uint16_t) ch_mock.sram[addr + 1] << 8;
+}
+
+static uint32_t
+ch_test_elis1024_get_sram32(uint16_t addr)
+{
+	return ch_test_elis1024_get_sram(addr) |
+	       (uint32_t) ch_test_elis1024_get_sram(addr + 2) << 16;
+}
+
+/* runs the main loop until the sample has been stored */
+static void
+ch_test_elis1024_wait(OoElis1024Context *ctx)
+{
+	uint32_t i;
+
+	for (i = 0; oo_elis1024_get_state(ctx) != CH_SPECTRAL_STATE_IDLE; i++) {
+		ch_test_assert_cmpint(oo_elis1024_poll(ctx), ==, CH_ERROR_NONE);
+		ch_test_assert_cmpint(i, <, 10000000);
+	}
+}
+
+/*
+ * The pixels are stored in 32 DMA transfers of 32 pixels, and as the ADC
+ * is much slower than the SPI bus only the last block is ever waited for.
+ */
+static void
+ch_test_elis1024_readout_dma(void)
+{
+	OoElis1024Context ctx;
+	uint16_t i;
+
+	ch_test_elis1024_setup(&ctx);
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 10, 1, 0x0000),
+			      ==, CH_ERROR_NONE);
+	ch_test_elis1024_wait(&ctx);
+
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+	ch_test_assert_cmpint(ch_mock.conversions, ==, 1024);
+	ch_test_assert_cmpint(ch_mock.dma_transfers, ==, 1024 / 32);
+	ch_test_assert_cmpint(ch_mock.dma_bytes, ==, 1024 * 2);
+
+	/* one mode change, then the command header for each block */
+	ch_test_assert_cmpint(ch_mock.spi_bytes, ==, 2 + 3 * (1024 / 32));
+	ch_test_assert_cmpint(ch_mock.dma_busy_polls * CH_MOCK_STEP_NS, <=,
+			      32 * 2 * CH_MOCK_SPI_BYTE_NS);
+
+	for (i = 0; i < CH_MOCK_NUM_PIXELS; i++)
+		ch_test_assert_cmpint(ch_test_elis1024_get_sram(i * 2),
+				      ==, ch_mock.pixels[i]);
+}
+
+/* a different spectrum for each frame */
+static uint16_t
+ch_test_elis1024_get_frame_pixel(uint16_t i, uint32_t frame)
+{
+	return ((i * 37 + 11 + frame * 293) % 1024) << 6;
+}
+
+/*
+ * When averaging, the 32 bit sum of every pixel is kept and the rounded
+ * mean of all the frames is stored over the last frame.
+ */
+static void
+ch_test_elis1024_accumulate(void)
+{
+	OoElis1024Context ctx;
+	uint32_t polls = 0;
+	uint32_t sum;
+	uint16_t i;
+	uint8_t k;
+
+	ch_test_elis1024_setup(&ctx);
+	oo_elis1024_set_accumulator(&ctx, 0x0800);
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 10, 5, 0x0000),
+			      ==, CH_ERROR_NONE);
+
+	/* set each frame before it is read out */
+	while (oo_elis1024_get_state(&ctx) != CH_SPECTRAL_STATE_IDLE) {
+		for (i = 0; i < CH_MOCK_NUM_PIXELS; i++) {
+			ch_mock.pixels[i] =
+				ch_test_elis1024_get_frame_pixel(i, ch_mock.frames);
+		}
+		ch_test_assert_cmpint(oo_elis1024_poll(&ctx), ==, CH_ERROR_NONE);
+		ch_test_assert_cmpint(polls++, <, 10000000);
+	}
+	ch_test_assert_cmpint(ch_mock.frames, ==, 5);
+	ch_test_assert_cmpint(oo_elis1024_get_sequence(&ctx), ==, 1);
+
+	/* the sums are wider than any one pixel */
+	for (i = 0; i < CH_MOCK_NUM_PIXELS; i++) {
+		sum = 0;
+		for (k = 0; k < 5; k++)
+			sum += ch_test_elis1024_get_frame_pixel(i, k);
+		ch_test_assert_cmpint(ch_test_elis1024_get_sram32(0x0800 + i * 4),
+				      ==, sum);
+		ch_test_assert_cmpint(ch_test_elis1024_get_sram(i * 2),
+				      ==, (sum + 2) / 5);
+	}
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/*
+ * Each poll returns straight away while integrating, so USB is serviced,
+ * and the shutter is closed on the Timer1 tick the integration ends on.
+ */
+static void
+ch_test_elis1024_poll_nonblocking(void)
+{
+	OoElis1024Context ctx;
+	uint64_t before;
+	uint64_t longest = 0;
+	uint32_t polls = 0;
+	uint64_t exposure;
+
+	ch_test_elis1024_setup(&ctx);
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 100, 1, 0x0000),
+			      ==, CH_ERROR_NONE);
+	ch_test_assert_cmpint(oo_elis1024_get_state(&ctx), ==,
+			      CH_SPECTRAL_STATE_INTEGRATING);
+
+	/* a second reading cannot be started */
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 100, 1, 0x0000),
+			      ==, CH_ERROR_DEVICE_BUSY);
+
+	/* only the poll that reads out the frame takes any time */
+	while (ch_mock.frames == 0) {
+		before = ch_mock.now;
+		ch_test_assert_cmpint(oo_elis1024_poll(&ctx), ==, CH_ERROR_NONE);
+		if (ch_mock.frames == 0 && ch_mock.now - before > longest)
+			longest = ch_mock.now - before;
+		polls++;
+	}
+	ch_test_assert_cmpint(longest, <, 3000000);
+	ch_test_assert_cmpint(polls, >, 1000);
+	ch_test_assert_cmpint(oo_elis1024_get_state(&ctx), ==,
+			      CH_SPECTRAL_STATE_IDLE);
+	ch_test_assert_cmpint(oo_elis1024_get_sequence(&ctx), ==, 1);
+
+	/* within a tick and the few instructions either side */
+	exposure = ch_mock.shutter_close - ch_mock.shutter_open;
+	ch_test_assert_cmpint(exposure, >=, 100000000);
+	ch_test_assert_cmpint(exposure, <, 100000000 + 5000);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/* a main loop held up past the end makes the exposure longer, not wrong */
+static void
+ch_test_elis1024_poll_late(void)
+{
+	OoElis1024Context ctx;
+	uint64_t exposure;
+
+	ch_test_elis1024_setup(&ctx);
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 20, 1, 0x0000),
+			      ==, CH_ERROR_NONE);
+	while (oo_elis1024_get_state(&ctx) != CH_SPECTRAL_STATE_IDLE) {
+		ch_mock_advance(7000000);
+		ch_test_assert_cmpint(oo_elis1024_poll(&ctx), ==, CH_ERROR_NONE);
+	}
+	exposure = ch_mock.shutter_close - ch_mock.shutter_open;
+	ch_test_assert_cmpint(exposure, >=, 20000000);
+	ch_test_assert_cmpint(exposure, <, 20000000 + 7000000 + 100000);
+	ch_test_assert_cmpint(oo_elis1024_get_sequence(&ctx), ==, 1);
+}
+
+/*
+ * In continuous mode the next integration starts as soon as the pixels are
+ * in the hold capacitors, so each frame is read out while the next one is
+ * integrating and every frame integrates for the same time.
+ */
+static void
+ch_test_elis1024_continuous(void)
+{
+	OoElis1024Context ctx;
+	uint64_t open;
+	uint64_t exposure;
+	uint16_t seq;
+
+	ch_test_elis1024_setup(&ctx);
+	ch_test_assert_cmpint(oo_elis1024_start_continuous(&ctx, 60, 0x0000),
+			      ==, CH_ERROR_NONE);
+	ch_mock_sync();
+	open = ch_mock.shutter_open;
+	for (seq = 0; seq < 4; ) {
+		ch_test_assert_cmpint(oo_elis1024_poll(&ctx), ==, CH_ERROR_NONE);
+		if (oo_elis1024_get_sequence(&ctx) == seq)
+			continue;
+		seq++;
+		ch_test_assert_cmpint(oo_elis1024_get_state(&ctx), ==,
+				      CH_SPECTRAL_STATE_INTEGRATING);
+		ch_test_assert_cmpint(ch_mock.frames, ==, seq);
+		ch_test_assert_cmpint(ch_mock.conversions, ==, seq * 1024);
+
+		/* the sensor is only reset before the first frame */
+		ch_test_assert_cmpint(ch_mock.shutter_opens, ==, seq + 1);
+
+		/* the integration time is exact */
+		exposure = ch_mock.shutter_close - open;
+		ch_test_assert_cmpint(exposure, >=, 60000000);
+		ch_test_assert_cmpint(exposure, <, 60000000 + 5000);
+
+		/* the next integration starts before the readout */
+		ch_test_assert_cmpint(ch_mock.shutter_open - ch_mock.shutter_close,
+				      >=, 10000);
+		ch_test_assert_cmpint(ch_mock.shutter_open - ch_mock.shutter_close,
+				      <, 10000 + 5000);
+		ch_test_assert_cmpint(ch_mock.readout_start, >, ch_mock.shutter_open);
+		ch_test_assert_cmpint(ch_mock.readout_end, <,
+				      ch_mock.shutter_open + 60000000);
+		open = ch_mock.shutter_open;
+	}
+
+	/* stopping closes the shutter without reading out */
+	oo_elis1024_stop(&ctx);
+	ch_mock_advance(100000000);
+	ch_test_assert_cmpint(oo_elis1024_poll(&ctx), ==, CH_ERROR_NONE);
+	ch_test_assert_cmpint(oo_elis1024_get_state(&ctx), ==,
+			      CH_SPECTRAL_STATE_IDLE);
+	ch_test_assert_cmpint(ch_mock.shutter_close, >, open);
+	ch_test_assert_cmpint(ch_mock.frames, ==, 4);
+	ch_test_assert_cmpint(oo_elis1024_get_sequence(&ctx), ==, 4);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/* the readout takes about 43ms, which is then the shortest integration */
+static void
+ch_test_elis1024_continuous_short(void)
+{
+	OoElis1024Context ctx;
+	uint64_t open;
+	uint64_t exposure;
+	uint64_t readout = 0;
+	uint16_t seq;
+
+	ch_test_elis1024_setup(&ctx);
+	ch_test_assert_cmpint(oo_elis1024_start_continuous(&ctx, 20, 0x0000),
+			      ==, CH_ERROR_NONE);
+	ch_mock_sync();
+	open = ch_mock.shutter_open;
+	for (seq = 0; seq < 3; ) {
+		ch_test_assert_cmpint(oo_elis1024_poll(&ctx), ==, CH_ERROR_NONE);
+		if (oo_elis1024_get_sequence(&ctx) == seq)
+			continue;
+		seq++;
+		exposure = ch_mock.shutter_close - open;
+		if (seq == 1) {
+			ch_test_assert_cmpint(exposure, <, 20000000 + 5000);
+		} else {
+			ch_test_assert_cmpint(exposure, >=, readout);
+			ch_test_assert_cmpint(exposure, <, readout + 1000000);
+		}
+		readout = ch_mock.readout_end - ch_mock.readout_start;
+		ch_test_assert_cmpint(readout, >, 20000000);
+		open = ch_mock.shutter_open;
+	}
+	oo_elis1024_stop(&ctx);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/* what the statistics of a window of the mock pixels should be */
+static void
+ch_test_elis1024_get_expected_stats(uint16_t start, uint16_t len,
+				    ChSpectralStats *stats)
+{
+	uint16_t i;
+	uint16_t val;
+
+	memset(stats, 0, sizeof(ChSpectralStats));
+	stats->min = 0xffff;
+	for (i = start; i < start + len; i++) {
+		val = ch_mock.pixels[i];
+		if (val < stats->min)
+			stats->min = val;
+
+		/* the pixels are read last first, so a tie is the highest */
+		if (val >= stats->max) {
+			stats->max = val;
+			stats->argmax = i;
+		}
+		if (val >= 0xffc0)
+			stats->saturated++;
+		stats->sum += val;
+	}
+}
+
+/*
+ * The statistics cover the unbinned pixels in the window, with any pixel
+ * at full scale counted as saturated.
+ */
+static void
+ch_test_elis1024_stats(void)
+{
+	OoElis1024Context ctx;
+	ChSpectralStats expected;
+	ChSpectralStats stats;
+
+	ch_test_elis1024_setup(&ctx);
+	ch_mock.pixels[10] = 0xffc0;
+	ch_mock.pixels[20] = 0xffc0;
+	ch_mock.pixels[30] = 0x0000;
+	ch_mock.pixels[40] = 0x0000;
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 10, 1, 0x0000),
+			      ==, CH_ERROR_NONE);
+	ch_test_elis1024_wait(&ctx);
+	oo_elis1024_get_stats(&ctx, &stats);
+	ch_test_elis1024_get_expected_stats(0, CH_MOCK_NUM_PIXELS, &expected);
+	ch_test_assert_cmpint(stats.min, ==, 0x0000);
+	ch_test_assert_cmpint(stats.max, ==, 0xffc0);
+	ch_test_assert_cmpint(stats.argmax, ==, expected.argmax);
+	ch_test_assert_cmpint(stats.saturated, ==, 3);
+	ch_test_assert_cmpint(stats.sum, ==, expected.sum);
+
+	/* only the pixels in the window */
+	ch_test_assert_cmpint(oo_elis1024_set_window(&ctx, 15, 200), ==,
+			      CH_ERROR_NONE);
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 10, 1, 0x0000),
+			      ==, CH_ERROR_NONE);
+	ch_test_elis1024_wait(&ctx);
+	oo_elis1024_get_stats(&ctx, &stats);
+	ch_test_elis1024_get_expected_stats(15, 200, &expected);
+	ch_test_assert_cmpint(stats.min, ==, expected.min);
+	ch_test_assert_cmpint(stats.max, ==, expected.max);
+	ch_test_assert_cmpint(stats.argmax, ==, 20);
+	ch_test_assert_cmpint(stats.saturated, ==, 1);
+	ch_test_assert_cmpint(stats.sum, ==, expected.sum);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/*
+ * Isolated hot pixels are stored as the rounded mean of their neighbours,
+ * or the one neighbour at an edge of the window, and never show up in the
+ * statistics. When binning the pixel read before is used instead.
+ */
+static void
+ch_test_elis1024_hot_pixels(void)
+{
+	OoElis1024Context ctx;
+	ChSpectralStats stats;
+	const uint16_t hot[] = { 0, 100, 110, 500, 1023 };
+	uint16_t good[CH_MOCK_NUM_PIXELS];
+	uint16_t expected;
+	uint32_t sum = 0;
+	uint16_t i;
+	uint8_t j;
+
+	ch_test_elis1024_setup(&ctx);
+	memcpy(good, ch_mock.pixels, sizeof(good));
+	for (j = 0; j < sizeof(hot) / sizeof(hot[0]); j++)
+		ch_mock.pixels[hot[j]] = 0xffc0;
+	oo_elis1024_set_hot_pixels(&ctx, hot, sizeof(hot) / sizeof(hot[0]));
+
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 10, 1, 0x0000),
+			      ==, CH_ERROR_NONE);
+	ch_test_elis1024_wait(&ctx);
+	for (i = 0; i < CH_MOCK_NUM_PIXELS; i++) {
+		expected = good[i];
+		if (i == 0)
+			expected = good[1];
+		else if (i == 1023)
+			expected = good[1022];
+		else if (i == 100 || i == 110 || i == 500)
+			expected = (good[i - 1] + good[i + 1] + 1) / 2;
+		ch_test_assert_cmpint(ch_test_elis1024_get_sram(i * 2), ==, expected);
+	}
+
+	/* each hot pixel counts as the one read before it, apart from the
+	 * first pixel read, and pixel 996 really is saturated */
+	for (i = 0; i < CH_MOCK_NUM_PIXELS; i++) {
+		if (ch_mock.pixels[i] == good[i] || i == 1023)
+			sum += ch_mock.pixels[i];
+		else
+			sum += good[i + 1];
+	}
+	oo_elis1024_get_stats(&ctx, &stats);
+	ch_test_assert_cmpint(stats.sum, ==, sum);
+	ch_test_assert_cmpint(stats.saturated, ==, 2);
+
+	/* a hot pixel at the start of a window only has one neighbour */
+	ch_test_assert_cmpint(oo_elis1024_set_window(&ctx, 100, 11), ==,
+			      CH_ERROR_NONE);
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 10, 1, 0x0000),
+			      ==, CH_ERROR_NONE);
+	ch_test_elis1024_wait(&ctx);
+	ch_test_assert_cmpint(ch_test_elis1024_get_sram(0), ==, good[101]);
+	for (i = 1; i < 10; i++)
+		ch_test_assert_cmpint(ch_test_elis1024_get_sram(i * 2), ==,
+				      good[100 + i]);
+	ch_test_assert_cmpint(ch_test_elis1024_get_sram(20), ==, good[109]);
+
+	/* the bins only ever see good values */
+	ch_test_assert_cmpint(oo_elis1024_set_window(&ctx, 0, 1024), ==,
+			      CH_ERROR_NONE);
+	ch_test_assert_cmpint(oo_elis1024_set_binning(&ctx, 2), ==,
+			      CH_ERROR_NONE);
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 10, 1, 0x0000),
+			      ==, CH_ERROR_NONE);
+	ch_test_elis1024_wait(&ctx);
+	ch_test_assert_cmpint(ch_test_elis1024_get_sram(50 * 2), ==, good[101]);
+	ch_test_assert_cmpint(ch_test_elis1024_get_sram(55 * 2), ==, good[111]);
+	ch_test_assert_cmpint(ch_test_elis1024_get_sram(250 * 2), ==, good[501]);
+	ch_test_assert_cmpint(ch_test_elis1024_get_sram(1 * 2), ==,
+			      (good[2] + good[3] + 1) / 2);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/*
+ * Only the pixels in the window are converted, and they are stored packed
+ * together from the offset, with any that do not fill a whole bin dropped.
+ */
+static void
+ch_test_elis1024_window(void)
+{
+	OoElis1024Context ctx;
+	uint16_t i;
+
+	ch_test_elis1024_setup(&ctx);
+	ch_test_assert_cmpint(oo_elis1024_set_window(&ctx, 0, 0), ==,
+			      CH_ERROR_INVALID_VALUE);
+	ch_test_assert_cmpint(oo_elis1024_set_window(&ctx, 1024, 1), ==,
+			      CH_ERROR_INVALID_VALUE);
+	ch_test_assert_cmpint(oo_elis1024_set_window(&ctx, 1000, 25), ==,
+			      CH_ERROR_INVALID_VALUE);
+	ch_test_assert_cmpint(oo_elis1024_get_pixel_count(&ctx), ==, 1024);
+
+	ch_test_assert_cmpint(oo_elis1024_set_window(&ctx, 300, 100), ==,
+			      CH_ERROR_NONE);
+	ch_test_assert_cmpint(oo_elis1024_get_pixel_count(&ctx), ==, 100);
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 10, 1, 0x0100),
+			      ==, CH_ERROR_NONE);
+
+	/* the window cannot change during a reading */
+	ch_test_assert_cmpint(oo_elis1024_set_window(&ctx, 0, 1024), ==,
+			      CH_ERROR_DEVICE_BUSY);
+	ch_test_elis1024_wait(&ctx);
+	ch_test_assert_cmpint(ch_mock.conversions, ==, 100);
+	for (i = 0; i < 100; i++)
+		ch_test_assert_cmpint(ch_test_elis1024_get_sram(0x0100 + i * 2),
+				      ==, ch_mock.pixels[300 + i]);
+	ch_test_assert_cmpint(ch_test_elis1024_get_sram(0x0100 - 2), ==, 0);
+	ch_test_assert_cmpint(ch_test_elis1024_get_sram(0x0100 + 200), ==, 0);
+
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/*
+ * The rounded mean of each bin is stored, which is within half of the
+ * lowest bit of the exact mean even when linearizing uses every bit.
+ */
+static void
+ch_test_elis1024_binning(void)
+{
+	OoElis1024Context ctx;
+	const uint8_t binnings[] = { 1, 2, 4, 8 };
+	uint16_t lut[CH_LINEARITY_POINTS];
+	uint16_t lin[CH_MOCK_NUM_PIXELS];
+	uint16_t low_bits = 0;
+	uint16_t val;
+	uint32_t sum;
+	int32_t err;
+	uint16_t i;
+	uint8_t b;
+	uint8_t j;
+	uint8_t k;
+
+	ch_test_elis1024_setup(&ctx);
+	for (i = 0; i < CH_LINEARITY_POINTS; i++)
+		lut[i] = i * 1987;
+	oo_elis1024_set_linearity(&ctx, lut);
+	for (i = 0; i < CH_MOCK_NUM_PIXELS; i++) {
+		lin[i] = chug_spectral_linearize(lut, ch_mock.pixels[i]);
+		low_bits |= lin[i] & 0x3f;
+	}
+	ch_test_assert_cmpint(low_bits, ==, 0x3f);
+
+	for (j = 0; j < sizeof(binnings); j++) {
+		b = binnings[j];
+		ch_test_assert_cmpint(oo_elis1024_set_binning(&ctx, b), ==,
+				      CH_ERROR_NONE);
+		ch_test_assert_cmpint(oo_elis1024_get_pixel_count(&ctx), ==,
+				      CH_MOCK_NUM_PIXELS / b);
+		ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 10, 1, 0x0000),
+				      ==, CH_ERROR_NONE);
+		ch_test_elis1024_wait(&ctx);
+		for (i = 0; i < CH_MOCK_NUM_PIXELS / b; i++) {
+			sum = 0;
+			for (k = 0; k < b; k++)
+				sum += lin[i * b + k];
+			val = ch_test_elis1024_get_sram(i * 2);
+			ch_test_assert_cmpint(val, ==, (sum + b / 2) / b);
+			err = (int32_t) val * b - (int32_t) sum;
+			ch_test_assert_cmpint(err * 2, <=, b);
+			ch_test_assert_cmpint(err * 2, >=, -b);
+		}
+	}
+
+	/* 10 pixels make two bins of 4, and the last 2 are not converted */
+	ch_mock.conversions = 0;
+	memset(ch_mock.sram, 0x00, sizeof(ch_mock.sram));
+	ch_test_assert_cmpint(oo_elis1024_set_window(&ctx, 300, 10), ==,
+			      CH_ERROR_NONE);
+	ch_test_assert_cmpint(oo_elis1024_set_binning(&ctx, 4), ==,
+			      CH_ERROR_NONE);
+	ch_test_assert_cmpint(oo_elis1024_get_pixel_count(&ctx), ==, 2);
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 10, 1, 0x0100),
+			      ==, CH_ERROR_NONE);
+	ch_test_elis1024_wait(&ctx);
+	ch_test_assert_cmpint(ch_mock.conversions, ==, 8);
+	for (i = 0; i < 2; i++) {
+		sum = 0;
+		for (k = 0; k < 4; k++)
+			sum += lin[300 + i * 4 + k];
+		ch_test_assert_cmpint(ch_test_elis1024_get_sram(0x0100 + i * 2),
+				      ==, (sum + 2) / 4);
+	}
+	ch_test_assert_cmpint(ch_test_elis1024_get_sram(0x0100 + 4), ==, 0);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/* values are checked whole, so a large wValue is never truncated */
+static void
+ch_test_elis1024_setters(void)
+{
+	OoElis1024Context ctx;
+
+	ch_test_elis1024_setup(&ctx);
+	ch_test_assert_cmpint(oo_elis1024_set_binning(&ctx, 0x0102), ==,
+			      CH_ERROR_INVALID_VALUE);
+	ch_test_assert_cmpint(oo_elis1024_set_binning(&ctx, 0), ==,
+			      CH_ERROR_INVALID_VALUE);
+	ch_test_assert_cmpint(oo_elis1024_set_binning(&ctx, 3), ==,
+			      CH_ERROR_INVALID_VALUE);
+	ch_test_assert_cmpint(ctx.binning, ==, 1);
+	ch_test_assert_cmpint(oo_elis1024_set_binning(&ctx, 8), ==,
+			      CH_ERROR_NONE);
+	ch_test_assert_cmpint(ctx.binning, ==, 8);
+
+	ch_test_assert_cmpint(oo_elis1024_set_oversample(&ctx, 0x0104), ==,
+			      CH_ERROR_INVALID_VALUE);
+	ch_test_assert_cmpint(oo_elis1024_set_oversample(&ctx, 2), ==,
+			      CH_ERROR_INVALID_VALUE);
+	ch_test_assert_cmpint(ctx.oversample, ==, 1);
+	ch_test_assert_cmpint(oo_elis1024_set_oversample(&ctx, 16), ==,
+			      CH_ERROR_NONE);
+	ch_test_assert_cmpint(ctx.oversample, ==, 16);
+
+	ch_test_assert_cmpint(oo_elis1024_set_profile(&ctx, 0x0100 +
+						       CH_READOUT_PROFILE_FAST),
+			      ==, CH_ERROR_INVALID_VALUE);
+	ch_test_assert_cmpint(oo_elis1024_set_profile(&ctx, CH_READOUT_PROFILE_LAST),
+			      ==, CH_ERROR_INVALID_VALUE);
+	ch_test_assert_cmpint(ctx.profile, ==, CH_READOUT_PROFILE_ACCURATE);
+	ch_test_assert_cmpint(oo_elis1024_set_profile(&ctx, CH_READOUT_PROFILE_FAST),
+			      ==, CH_ERROR_NONE);
+	ch_test_assert_cmpint(ctx.profile, ==, CH_READOUT_PROFILE_FAST);
+
+	/* nothing can change during a reading */
+	ch_test_assert_cmpint(oo_elis1024_start_sample(&ctx, 10, 1, 0x0000),
+			      ==, CH_ERROR_NONE);
+	ch_test_assert_cmpint(oo_elis1024_set_binning(&ctx, 1), ==,
+			      CH_ERROR_DEVICE_BUSY);
+	ch_test_assert_cmpint(oo_elis1024_set_oversample(&ctx, 1), ==,
+			      CH_ERROR_DEVICE_BUSY);
+	ch_test_assert_cmpint(oo_elis1024_set_profile(&ctx, CH_READOUT_PROFILE_ACCURATE),
+			      ==, CH_ERROR_DEVICE_BUSY);
+	ch_test_elis1024_wait(&ctx);
+}
+
+int
+main(void)
+{
+	ch_test_run(ch_test_elis1024_readout_dma);
+	ch_test_run(ch_test_elis1024_accumulate);
+	ch_test_run(ch_test_elis1024_poll_nonblocking);
+	ch_test_run(ch_test_elis1024_poll_late);
+	ch_test_run(ch_test_elis1024_continuous);
+	ch_test_run(ch_test_elis1024_continuous_short);
+	ch_test_run(ch_test_elis1024_stats);
+	ch_test_run(ch_test_elis1024_hot_pixels);
+	ch_test_run(ch_test_elis1024_window);
+	ch_test_run(ch_test_elis1024_binning);
+	ch_test_run(ch_test_elis1024_setters);
+	return 0;
+}
@@ -0,0 +1,242 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "ch-encode.h"
+#include "ch-test.h"
+
+#define CH_TEST_ENCODE_MAX		512
+
+/* the host side of CH_SRAM_ENCODING_PACKED12 */
+static uint16_t
+ch_test_encode_decode_packed12(const uint8_t *buf, uint16_t len, uint16_t *out)
+{
+	uint16_t i;
+	uint16_t n = 0;
+
+	for (i = 0; i + 3 <= len; i += 3) {
+		out[n++] = (buf[i] | (uint16_t) (buf[i + 1] & 0x0f) << 8) << 4;
+		out[n++] = (buf[i + 1] >> 4 | (uint16_t) buf[i + 2] << 4) << 4;
+	}
+	if (i + 2 == len)
+		out[n++] = (buf[i] | (uint16_t) buf[i + 1] << 8) << 4;
+	return n;
+}
+
+/* the host side of CH_SRAM_ENCODING_DELTA */
+static uint16_t
+ch_test_encode_decode_delta(const uint8_t *buf, uint16_t len, uint16_t *out)
+{
+	uint16_t i = 1;
+	uint16_t n = 0;
+	uint16_t prev = 0;
+	uint16_t zz;
+	uint8_t shift = buf[0];
+
+	while (i < len) {
+		zz = buf[i++];
+		if (zz & 0x80)
+			zz = (zz & 0x7f) << 8 | buf[i++];
+		prev += zz & 1 ? ~(zz >> 1) : zz >> 1;
+		out[n++] = prev << shift;
+	}
+	return n;
+}
+
+/* a reply as long as the raw data is the raw data, and anything shorter
+ * decodes to exactly the same values */
+static uint16_t
+ch_test_encode(uint16_t (*encode) (uint8_t *, uint16_t),
+	       uint16_t (*decode) (const uint8_t *, uint16_t, uint16_t *),
+	       const uint16_t *values, uint16_t n)
+{
+	uint8_t buf[CH_TEST_ENCODE_MAX * 2];
+	uint16_t out[CH_TEST_ENCODE_MAX];
+	uint16_t i;
+	uint16_t len;
+
+	for (i = 0; i < n; i++) {
+		buf[i * 2 + 0] = values[i];
+		buf[i * 2 + 1] = values[i] >> 8;
+	}
+	len = encode(buf, n * 2);
+	ch_test_assert_cmpint(len, <=, n * 2);
+	if (len == n * 2) {
+		for (i = 0; i < n; i++) {
+			out[i] = buf[i * 2 + 0] | (uint16_t) buf[i * 2 + 1] << 8;
+			ch_test_assert_cmpint(out[i], ==, values[i]);
+		}
+		return len;
+	}
+	ch_test_assert_cmpint(decode(buf, len, out), ==, n);
+	for (i = 0; i < n; i++)
+		ch_test_assert_cmpint(out[i], ==, values[i]);
+	return len;
+}
+
+/* a smooth spectrum with a little noise, as read from the sensor */
+static void
+ch_test_encode_spectrum(uint16_t *values, uint16_t n)
+{
+	double tmp;
+	uint16_t i;
+
+	for (i = 0; i < n; i++) {
+		tmp = (i - n / 3.0) / (n / 12.0);
+		values[i] = 0x1000 + 0xb000 * exp(-0.5 * tmp * tmp);
+		values[i] = (values[i] & 0xffc0) + ((i * 7919) % 5) * 0x40;
+	}
+}
+
+static void
+ch_test_encode_packed12(void)
+{
+	uint16_t values[CH_TEST_ENCODE_MAX];
+	uint16_t i;
+	uint16_t n;
+
+	for (i = 0; i < CH_TEST_ENCODE_MAX; i++)
+		values[i] = (i * 40503) & 0xfff0;
+
+	/* 3 bytes for each pair, and 2 for an odd value at the end, except
+	 * a single value which would be no shorter */
+	ch_test_assert_cmpint(ch_test_encode(chug_encode_packed12,
+					     ch_test_encode_decode_packed12,
+					     values, 1), ==, 2);
+	for (n = 2; n <= CH_TEST_ENCODE_MAX; n++) {
+		ch_test_assert_cmpint(ch_test_encode(chug_encode_packed12,
+						     ch_test_encode_decode_packed12,
+						     values, n),
+				      ==, (n / 2) * 3 + (n % 2) * 2);
+	}
+
+	/* any of the low 4 bits set in any value is sent raw */
+	for (i = 0; i < 4; i++) {
+		values[CH_TEST_ENCODE_MAX - 1] |= 1 << i;
+		ch_test_assert_cmpint(ch_test_encode(chug_encode_packed12,
+						     ch_test_encode_decode_packed12,
+						     values, CH_TEST_ENCODE_MAX),
+				      ==, CH_TEST_ENCODE_MAX * 2);
+		values[CH_TEST_ENCODE_MAX - 1] &= 0xfff0;
+	}
+}
+
+static void
+ch_test_encode_delta(void)
+{
+	uint16_t values[CH_TEST_ENCODE_MAX];
+	uint16_t i;
+	uint16_t len;
+	uint16_t n;
+
+	/* the largest steps either way still fit in 2 bytes, but alone they
+	 * are no shorter than the raw data */
+	for (i = 0; i < CH_TEST_ENCODE_MAX; i++)
+		values[i] = i % 2 ? 0xfffc : 0x0000;
+	for (n = 1; n <= CH_TEST_ENCODE_MAX; n++) {
+		len = ch_test_encode(chug_encode_delta,
+				     ch_test_encode_decode_delta,
+				     values, n);
+		ch_test_assert_cmpint(len, ==, n * 2);
+	}
+
+	/* mixed with small steps they are shorter */
+	for (i = 0; i < CH_TEST_ENCODE_MAX; i++)
+		values[i] = i % 4 ? 0x0004 * i : 0xfffc;
+	for (n = 4; n <= CH_TEST_ENCODE_MAX; n++) {
+		len = ch_test_encode(chug_encode_delta,
+				     ch_test_encode_decode_delta,
+				     values, n);
+		ch_test_assert_cmpint(len, <, n * 2);
+	}
+}
+
+/* averaged, linearized and interpolated values use every bit */
+static void
+ch_test_encode_low_bits(void)
+{
+	uint16_t values[CH_TEST_ENCODE_MAX];
+	uint16_t i;
+	uint16_t len;
+
+	/* the low 2 bits are enough for the delta encoding */
+	ch_test_encode_spectrum(values, CH_TEST_ENCODE_MAX);
+	for (i = 0; i < CH_TEST_ENCODE_MAX; i++)
+		values[i] |= (i % 3) << 2;
+	ch_test_assert_cmpint(ch_test_encode(chug_encode_packed12,
+					     ch_test_encode_decode_packed12,
+					     values, CH_TEST_ENCODE_MAX),
+			      ==, sizeof(values));
+	len = ch_test_encode(chug_encode_delta,
+			     ch_test_encode_decode_delta,
+			     values, CH_TEST_ENCODE_MAX);
+	ch_test_assert_cmpint(len, <, sizeof(values));
+
+	/* but neither is used when bit 0 or 1 is set */
+	for (i = 0; i < 2; i++) {
+		values[CH_TEST_ENCODE_MAX / 2] |= 1 << i;
+		ch_test_assert_cmpint(ch_test_encode(chug_encode_delta,
+						     ch_test_encode_decode_delta,
+						     values, CH_TEST_ENCODE_MAX),
+				      ==, sizeof(values));
+		ch_test_assert_cmpint(ch_test_encode(chug_encode_packed12,
+						     ch_test_encode_decode_packed12,
+						     values, CH_TEST_ENCODE_MAX),
+				      ==, sizeof(values));
+		values[CH_TEST_ENCODE_MAX / 2] &= ~(1 << i);
+	}
+}
+
+/*
+ * Nearly every step of a real spectrum fits in 1 byte, so the delta
+ * encoding is about half the size of the raw values, which is much better
+ * than packing.
+ */
+static void
+ch_test_encode_ratio(void)
+{
+	uint16_t values[CH_TEST_ENCODE_MAX];
+	uint16_t len_delta;
+	uint16_t len_packed;
+	uint16_t len_raw = sizeof(values);
+
+	ch_test_encode_spectrum(values, CH_TEST_ENCODE_MAX);
+	len_packed = ch_test_encode(chug_encode_packed12,
+				    ch_test_encode_decode_packed12,
+				    values, CH_TEST_ENCODE_MAX);
+	len_delta = ch_test_encode(chug_encode_delta,
+				   ch_test_encode_decode_delta,
+				   values, CH_TEST_ENCODE_MAX);
+	ch_test_assert_cmpint(len_packed * 4, ==, len_raw * 3);
+	ch_test_assert_cmpint(len_delta * 100, <=, len_raw * 55);
+}
+
+int
+main(void)
+{
+	ch_test_run(ch_test_encode_packed12);
+	ch_test_run(ch_test_encode_delta);
+	ch_test_run(ch_test_encode_low_bits);
+	ch_test_run(ch_test_encode_ratio);
+	return 0;
+}
@@ -0,0 +1,430 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "ColorHug.h"
+#include "ch-test.h"
+#include "ch-spectral.h"
+
+/* a dark pixel brighter than the frame is clipped rather than wrapping */
+static void
+ch_test_spectral_subtract_dark(void)
+{
+	uint16_t data[] = { 0x8000, 0x0040, 0x0040, 0x0000, 0xffc0, 0x1234 };
+	const uint16_t dark[] = { 0x0400, 0x0040, 0x0080, 0x0040, 0x0000, 0x0001 };
+	const uint16_t expected[] = { 0x7c00, 0x0000, 0x0000, 0x0000, 0xffc0, 0x1234 };
+	uint8_t i;
+
+	/* the last pixel is outside the length */
+	chug_spectral_subtract_dark(data, dark, 5);
+	for (i = 0; i < 6; i++)
+		ch_test_assert_cmpint(data[i], ==, expected[i]);
+}
+
+/* the prediction is the nearest whole ms, clamped to the allowed range */
+static void
+ch_test_spectral_predict_integration(void)
+{
+	const uint16_t probes[] = { 1, 3, 10, 100, 1000, 60000 };
+	double expected;
+	uint32_t peak;
+	uint16_t rc;
+	uint8_t i;
+
+	for (i = 0; i < sizeof(probes) / sizeof(probes[0]); i++) {
+		for (peak = 1; peak < CH_SPECTRAL_ADC_SATURATED; peak += 97) {
+			expected = floor((double) probes[i] * 0xc000 / peak + 0.5);
+			if (expected > 5000)
+				expected = 5000;
+			if (expected < 1)
+				expected = 1;
+			rc = chug_spectral_predict_integration(probes[i], peak,
+							       0xc000, 5000);
+			ch_test_assert_cmpint(rc, ==, expected);
+		}
+	}
+
+	/* saturated, so probe again with a quarter of the time */
+	rc = chug_spectral_predict_integration(100, 0xffc0, 0xc000, 5000);
+	ch_test_assert_cmpint(rc, ==, 25);
+	rc = chug_spectral_predict_integration(3, 0xffc0, 0xc000, 5000);
+	ch_test_assert_cmpint(rc, ==, 1);
+	rc = chug_spectral_predict_integration(100, 0xffc0, 0xc000, 10);
+	ch_test_assert_cmpint(rc, ==, 10);
+
+	/* no signal at all */
+	rc = chug_spectral_predict_integration(100, 0, 0xc000, 5000);
+	ch_test_assert_cmpint(rc, ==, 5000);
+
+	/* the largest values do not overflow */
+	rc = chug_spectral_predict_integration(0xffff, 1, 0xffff, 0xffff);
+	ch_test_assert_cmpint(rc, ==, 0xffff);
+	rc = chug_spectral_predict_integration(0xffff, 0xffbf, 0xffff, 0xffff);
+	ch_test_assert_cmpint(rc, ==, 0xffff);
+}
+
+/* a typical calibration, with a curvature of a few nm across the sensor */
+static const double _cal[] = { 355.0, 0.37, -0.0000251235, 0.0 };
+
+static void
+ch_test_spectral_cal_init(int32_t *cal)
+{
+	uint8_t k;
+	for (k = 0; k < 4; k++)
+		cal[k] = lround(_cal[k] * 65536.0);
+}
+
+/* the exact wavelength for the stored, rounded, coefficients */
+static double
+ch_test_spectral_wavelength(const int32_t *cal, double p)
+{
+	return (((cal[3] * p + cal[2]) * p + cal[1]) * p + cal[0]) / 65536.0;
+}
+
+/* the wavelength of a light source of 20nm FWHM centred on 550nm */
+static double
+ch_test_spectral_source(double wavelength)
+{
+	double tmp = (wavelength - 550.0) / 8.5;
+	return 0xc000 * exp(-0.5 * tmp * tmp) + 0x1000;
+}
+
+/*
+ * The wavelength is exact at each pixel and within 0.02nm between pixels,
+ * and the index finds each point of a wavelength grid to within the 1/64
+ * pixel resolution.
+ */
+static void
+ch_test_spectral_index(void)
+{
+	ChSpectralIndex idx;
+	double expected;
+	double lo;
+	double hi;
+	double mid;
+	int32_t cal[4];
+	int32_t wl;
+	uint32_t x;
+	uint16_t pixel;
+	uint16_t pos;
+	uint16_t wavelength;
+	uint8_t j;
+
+	ch_test_spectral_cal_init(cal);
+	for (pixel = 0; pixel < CH_SPECTRAL_NUM_PIXELS; pixel++) {
+		expected = ch_test_spectral_wavelength(cal, pixel) * 65536.0;
+		wl = chug_spectral_get_wavelength(cal, pixel);
+		ch_test_assert_cmpint(fabs(wl - expected), <, 1);
+	}
+	for (x = 0; x < CH_SPECTRAL_NUM_PIXELS << 6; x++) {
+		expected = ch_test_spectral_wavelength(cal, x / 64.0) * 65536.0;
+		wl = chug_spectral_get_wavelength_pos(cal, x);
+		ch_test_assert_cmpint(fabs(wl - expected), <, 65536 / 50);
+	}
+
+	chug_spectral_index_init(&idx, cal);
+	for (wavelength = 340; wavelength < 720; wavelength++) {
+		pos = chug_spectral_index_lookup(&idx, (int32_t) wavelength << 16);
+		if (wavelength < _cal[0] ||
+		    wavelength >= ch_test_spectral_wavelength(cal, 1022)) {
+			ch_test_assert_cmpint(pos, ==, CH_SPECTRAL_INDEX_INVALID);
+			continue;
+		}
+
+		/* the calibration is monotonic, so bisect in double */
+		lo = 0;
+		hi = CH_SPECTRAL_NUM_PIXELS - 1;
+		for (j = 0; j < 60; j++) {
+			mid = (lo + hi) / 2;
+			if (ch_test_spectral_wavelength(cal, mid) < wavelength)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		ch_test_assert_cmpint(fabs(pos - lo * 64), <=, 1);
+	}
+}
+
+/*
+ * A source sampled at each pixel and resampled onto a 1nm grid matches the
+ * source at the grid wavelengths, to within the error of interpolating
+ * linearly between pixels less than 0.4nm apart.
+ */
+static void
+ch_test_spectral_resample(void)
+{
+	ChSpectralIndex idx;
+	double expected;
+	int32_t cal[4];
+	uint32_t lo;
+	uint32_t hi;
+	uint16_t pixels[CH_SPECTRAL_NUM_PIXELS];
+	uint16_t pixel;
+	uint16_t pos;
+	uint16_t val;
+	uint16_t wavelength;
+	uint8_t frac;
+
+	/* the interpolation is correctly rounded */
+	for (lo = 0; lo <= 0xffff; lo += 0x0fff) {
+		for (hi = 0; hi <= 0xffff; hi += 0x0ffd) {
+			for (frac = 0; frac < 64; frac++) {
+				expected = lo + ((double) hi - lo) * frac / 64;
+				val = chug_spectral_interpolate(lo, hi, frac);
+				ch_test_assert_cmpint(fabs(val - expected), <=, 0.5);
+			}
+		}
+	}
+
+	ch_test_spectral_cal_init(cal);
+	for (pixel = 0; pixel < CH_SPECTRAL_NUM_PIXELS; pixel++) {
+		expected = ch_test_spectral_wavelength(cal, pixel);
+		pixels[pixel] = lround(ch_test_spectral_source(expected));
+	}
+	chug_spectral_index_init(&idx, cal);
+	for (wavelength = 380; wavelength <= 700; wavelength++) {
+		pos = chug_spectral_index_lookup(&idx, (int32_t) wavelength << 16);
+		ch_test_assert_cmpint(pos, !=, CH_SPECTRAL_INDEX_INVALID);
+		val = chug_spectral_interpolate(pixels[pos >> 6],
+						pixels[(pos >> 6) + 1],
+						pos & 0x3f);
+		expected = ch_test_spectral_source(wavelength);
+		ch_test_assert_cmpint(fabs(val - expected), <, 0xc000 / 200);
+	}
+}
+
+/* a few points of the CIE 1931 2 degree observer, as published */
+static const struct {
+	uint16_t	 wavelength;
+	double		 xyz[3];
+} _cie1931[] = {
+	{ 450, { 0.33620, 0.03800, 1.77211 } },
+	{ 555, { 0.51205, 1.00000, 0.00575 } },
+	{ 600, { 1.06220, 0.63100, 0.00080 } },
+	{ 650, { 0.28350, 0.10700, 0.00000 } },
+};
+
+/* the sum of the published y values from 380nm to 780nm in 5nm steps */
+#define CH_TEST_CIE1931_Y_SUM		21.371524
+
+/*
+ * The stored table matches the published observer, a flat spectrum gives
+ * the illuminant E white point, and the accumulated result only differs
+ * from a double precision sum by the truncation of each addition.
+ */
+static void
+ch_test_spectral_xyz(void)
+{
+	double cmf[CH_SPECTRAL_CIE_POINTS][3];
+	double expected[3];
+	uint32_t xyz[3];
+	uint16_t values[CH_SPECTRAL_CIE_POINTS];
+	uint8_t i;
+	uint8_t idx;
+	uint8_t k;
+
+	/* adding 2048 gives each table entry exactly */
+	for (i = 0; i < CH_SPECTRAL_CIE_POINTS; i++) {
+		memset(xyz, 0, sizeof(xyz));
+		chug_spectral_add_xyz(xyz, i, 2048);
+		for (k = 0; k < 3; k++)
+			cmf[i][k] = xyz[k] / 524288.0;
+	}
+	for (i = 0; i < sizeof(_cie1931) / sizeof(_cie1931[0]); i++) {
+		idx = (_cie1931[i].wavelength - CH_SPECTRAL_CIE_START) /
+		      CH_SPECTRAL_CIE_STEP;
+		for (k = 0; k < 3; k++) {
+			expected[k] = _cie1931[i].xyz[k] / CH_TEST_CIE1931_Y_SUM;
+			ch_test_assert(fabs(cmf[idx][k] - expected[k]) <= 1 / 524288.0);
+		}
+	}
+
+	/* a flat spectrum, where X=Y=Z to within 0.1% */
+	memset(xyz, 0, sizeof(xyz));
+	for (i = 0; i < CH_SPECTRAL_CIE_POINTS; i++)
+		chug_spectral_add_xyz(xyz, i, 0x8000);
+	for (k = 0; k < 3; k++)
+		ch_test_assert(fabs(xyz[k] / 256.0 - 0x8000) < 0x8000 / 1000.0);
+
+	/* an arbitrary spectrum, including the largest values */
+	for (i = 0; i < CH_SPECTRAL_CIE_POINTS; i++)
+		values[i] = i % 7 == 0 ? 0xffff : (i * 7919 + 13) & 0xffff;
+	memset(xyz, 0, sizeof(xyz));
+	memset(expected, 0, sizeof(expected));
+	for (i = 0; i < CH_SPECTRAL_CIE_POINTS; i++) {
+		chug_spectral_add_xyz(xyz, i, values[i]);
+		for (k = 0; k < 3; k++)
+			expected[k] += values[i] * cmf[i][k] * 256;
+	}
+	for (k = 0; k < 3; k++) {
+		ch_test_assert_cmpint(xyz[k], <=, expected[k]);
+		ch_test_assert_cmpint(xyz[k], >, expected[k] - CH_SPECTRAL_CIE_POINTS);
+	}
+}
+
+/*
+ * The correction matches interpolating the table in floating point to
+ * within rounding for every raw value, and a straight line table leaves
+ * the values unchanged.
+ */
+static void
+ch_test_spectral_linearize(void)
+{
+	double expected;
+	double frac;
+	double raw;
+	float lut_f[CH_LINEARITY_POINTS];
+	uint16_t lut[CH_LINEARITY_POINTS];
+	uint32_t value;
+	uint16_t val;
+	uint16_t last = 0;
+	uint8_t i;
+
+	/* a sensor that reads 4% low at half scale */
+	for (i = 0; i < CH_LINEARITY_POINTS; i++) {
+		raw = (double) i / (CH_LINEARITY_POINTS - 1);
+		lut_f[i] = 0xffff * raw * (1 + 0.16 * raw * (1 - raw));
+		lut[i] = lroundf(lut_f[i]);
+	}
+	for (value = 0; value <= 0xffff; value++) {
+		i = value >> CH_LINEARITY_SHIFT;
+		frac = (double) (value & ((1 << CH_LINEARITY_SHIFT) - 1)) /
+		       (1 << CH_LINEARITY_SHIFT);
+		expected = lut[i] + (lut[i + 1] - lut[i]) * frac;
+		val = chug_spectral_linearize(lut, value);
+		ch_test_assert(fabs(val - expected) <= 0.5);
+
+		/* and the table only adds its own rounding */
+		expected = lut_f[i] + (lut_f[i + 1] - lut_f[i]) * frac;
+		ch_test_assert(fabs(val - expected) <= 1.0);
+		ch_test_assert_cmpint(val, >=, last);
+		last = val;
+	}
+
+	/* the last entry is for 0x10000, which is clipped to 0xffff */
+	for (i = 0; i < CH_LINEARITY_POINTS - 1; i++)
+		lut[i] = i << CH_LINEARITY_SHIFT;
+	lut[CH_LINEARITY_POINTS - 1] = 0xffff;
+	for (value = 0; value <= 0xffff; value++) {
+		val = chug_spectral_linearize(lut, value);
+		if (value < 0xf800)
+			ch_test_assert_cmpint(val, ==, value);
+		else
+			ch_test_assert_cmpint(abs(val - (int32_t) value), <=, 1);
+	}
+}
+
+#define CH_TEST_SPECTRAL_PEAK_PIXELS	300
+
+/* finds the peaks a chunk at a time, as the firmware does from the SRAM */
+static uint8_t
+ch_test_spectral_find_peaks(const uint16_t *values, uint16_t count,
+			    uint8_t chunk, uint8_t width,
+			    ChSpectralPeak *peaks, uint8_t max)
+{
+	uint16_t i;
+	uint8_t found = 0;
+	uint8_t len = chunk;
+
+	for (i = width; i < count - width; i += len) {
+		if (count - width - i < chunk)
+			len = count - width - i;
+		found = chug_spectral_add_peaks(&values[i - width], len, width, i,
+						peaks, max, found);
+	}
+	return found;
+}
+
+/*
+ * The peaks of sampled Gaussians are found highest first, at the centre to
+ * within a few 1/64ths of a pixel wherever it falls between two pixels.
+ */
+static void
+ch_test_spectral_peaks(void)
+{
+	const double centre[] = { 200.0, 80.0, 140.0 };
+	const double height[] = { 40000, 30000, 20000 };
+	const double sigma[] = { 3.0, 5.0, 8.0 };
+	ChSpectralPeak peaks[4];
+	double tmp;
+	double val;
+	uint16_t values[CH_TEST_SPECTRAL_PEAK_PIXELS];
+	uint16_t i;
+	uint8_t found;
+	uint8_t j;
+	uint8_t k;
+
+	for (j = 0; j < 64; j++) {
+		for (i = 0; i < CH_TEST_SPECTRAL_PEAK_PIXELS; i++) {
+			val = 1000;
+			for (k = 0; k < 3; k++) {
+				tmp = (i - centre[k] - j / 64.0) / sigma[k];
+				val += height[k] * exp(-0.5 * tmp * tmp);
+			}
+			values[i] = lround(val);
+		}
+		found = ch_test_spectral_find_peaks(values,
+						    CH_TEST_SPECTRAL_PEAK_PIXELS,
+						    16, 2, peaks, 4);
+		ch_test_assert_cmpint(found, ==, 3);
+		for (k = 0; k < 3; k++) {
+			tmp = peaks[k].position - (centre[k] * 64 + j);
+			ch_test_assert(fabs(tmp) <= 3);
+			tmp = peaks[k].value - (height[k] + 1000);
+			ch_test_assert(fabs(tmp) <= height[k] * 0.01);
+		}
+	}
+
+	/* only the highest are kept, whatever order they are met in */
+	found = ch_test_spectral_find_peaks(values, CH_TEST_SPECTRAL_PEAK_PIXELS,
+					    16, 2, peaks, 2);
+	ch_test_assert_cmpint(found, ==, 2);
+	ch_test_assert_cmpint((peaks[0].position + 32) >> 6, ==, 201);
+	ch_test_assert_cmpint((peaks[1].position + 32) >> 6, ==, 81);
+
+	/* a plateau is one peak, half a pixel in from its start, and nothing
+	 * is found near the ends */
+	for (i = 0; i < CH_TEST_SPECTRAL_PEAK_PIXELS; i++)
+		values[i] = 1000;
+	for (i = 0; i < 4; i++)
+		values[i] = 60000 - i * 1000;
+	for (i = 100; i < 110; i++)
+		values[i] = 5000;
+	found = ch_test_spectral_find_peaks(values, CH_TEST_SPECTRAL_PEAK_PIXELS,
+					    16, 4, peaks, 4);
+	ch_test_assert_cmpint(found, ==, 1);
+	ch_test_assert_cmpint(peaks[0].position, ==, 100 * 64 + 32);
+}
+
+int
+main(void)
+{
+	ch_test_run(ch_test_spectral_subtract_dark);
+	ch_test_run(ch_test_spectral_predict_integration);
+	ch_test_run(ch_test_spectral_index);
+	ch_test_run(ch_test_spectral_resample);
+	ch_test_run(ch_test_spectral_xyz);
+	ch_test_run(ch_test_spectral_linearize);
+	ch_test_run(ch_test_spectral_peaks);
+	return 0;
+}
@@ -0,0 +1,317 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "ch-mock.h"
+#include "ch-test.h"
+#include "ch-sram.h"
+#include "mti_23k640.h"
+
+#define CH_TEST_SRAM_JOBS		8
+
+/* the order the callbacks were called in */
+static uint8_t _done[CH_TEST_SRAM_JOBS];
+static uint8_t _done_count;
+static uint8_t _done_busy;
+
+static void
+ch_test_sram_setup(void)
+{
+	ch_mock_reset();
+	_done_count = 0;
+	_done_busy = 0;
+}
+
+static void
+ch_test_sram_done_cb(void *user_data)
+{
+	/* the next transfer is already running */
+	if (DMACON1bits.DMAEN)
+		_done_busy++;
+	_done[_done_count++] = (uint8_t) (uintptr_t) user_data;
+}
+
+/*
+ * Up to four transfers can be queued, and they finish and call back in
+ * order, with each one started before the callback of the one before.
+ */
+static void
+ch_test_sram_queue(void)
+{
+	static uint8_t buf[CH_TEST_SRAM_JOBS][256];
+	uint16_t i;
+	uint8_t j;
+	int8_t rc;
+
+	ch_test_sram_setup();
+	for (j = 0; j < CH_TEST_SRAM_JOBS; j++) {
+		for (i = 0; i < sizeof(buf[j]); i++)
+			buf[j][i] = i * 3 + j;
+	}
+	for (j = 0; j < 4; j++) {
+		rc = mti_23k640_dma_queue_from_cpu(buf[j], j * 0x400,
+						   sizeof(buf[j]),
+						   ch_test_sram_done_cb,
+						   (void *) (uintptr_t) j);
+		ch_test_assert_cmpint(rc, ==, 0);
+	}
+	rc = mti_23k640_dma_queue_from_cpu(buf[4], 0x1000, sizeof(buf[4]),
+					   ch_test_sram_done_cb, NULL);
+	ch_test_assert_cmpint(rc, ==, -1);
+
+	/* nothing is called back until polled */
+	ch_mock_advance(1000000);
+	ch_test_assert_cmpint(_done_count, ==, 0);
+	mti_23k640_dma_poll();
+	ch_test_assert_cmpint(_done_count, ==, 1);
+
+	/* the slot just freed can be used */
+	rc = mti_23k640_dma_queue_from_cpu(buf[4], 0x1000, sizeof(buf[4]),
+					   ch_test_sram_done_cb, (void *) 4);
+	ch_test_assert_cmpint(rc, ==, 0);
+	mti_23k640_dma_flush();
+	ch_test_assert_cmpint(_done_count, ==, 5);
+	for (j = 0; j < 5; j++)
+		ch_test_assert_cmpint(_done[j], ==, j);
+	ch_test_assert_cmpint(_done_busy, ==, 4);
+	ch_test_assert_cmpint(ch_mock.dma_transfers, ==, 5);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+	for (j = 0; j < 5; j++) {
+		ch_test_assert(memcmp(&ch_mock.sram[j * 0x400], buf[j],
+				      sizeof(buf[j])) == 0);
+	}
+}
+
+/* where a chained read puts what was written */
+static uint8_t _readback[512];
+
+static void
+ch_test_sram_readback_cb(void *user_data)
+{
+	uint16_t addr = (uint16_t) (uintptr_t) user_data;
+	int8_t rc;
+
+	rc = mti_23k640_dma_queue_to_cpu(addr, _readback, sizeof(_readback),
+					 ch_test_sram_done_cb, (void *) 1);
+	ch_test_assert_cmpint(rc, ==, 0);
+	_done[_done_count++] = 0;
+}
+
+/*
+ * A callback can queue the next transfer, and a read queued after a write
+ * to the same address sees the written data, even when the DMA engine is
+ * slow to finish.
+ */
+static void
+ch_test_sram_chain(void)
+{
+	static uint8_t buf[512];
+	uint16_t i;
+	uint32_t polls = 0;
+	int8_t rc;
+
+	ch_test_sram_setup();
+	ch_mock.dma_latency = 200000;
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i ^ 0x5a;
+	memset(_readback, 0, sizeof(_readback));
+	rc = mti_23k640_dma_queue_from_cpu(buf, 0x1234, sizeof(buf),
+					   ch_test_sram_readback_cb,
+					   (void *) 0x1234);
+	ch_test_assert_cmpint(rc, ==, 0);
+	while (_done_count < 2) {
+		mti_23k640_dma_poll();
+		ch_test_assert_cmpint(polls++, <, 1000000);
+	}
+	ch_test_assert_cmpint(_done[0], ==, 0);
+	ch_test_assert_cmpint(_done[1], ==, 1);
+	ch_test_assert(memcmp(_readback, buf, sizeof(buf)) == 0);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+
+	/* nothing more to do */
+	mti_23k640_dma_poll();
+	ch_test_assert_cmpint(_done_count, ==, 2);
+}
+
+/* a blocking transfer finishes the queue first */
+static void
+ch_test_sram_blocking(void)
+{
+	static uint8_t buf[2][128];
+	uint8_t tmp[128];
+	uint8_t j;
+	int8_t rc;
+
+	ch_test_sram_setup();
+	ch_mock.dma_latency = 50000;
+	for (j = 0; j < 2; j++) {
+		memset(buf[j], 0x11 * (j + 1), sizeof(buf[j]));
+		rc = mti_23k640_dma_queue_from_cpu(buf[j], 0x0100,
+						   sizeof(buf[j]),
+						   ch_test_sram_done_cb,
+						   (void *) (uintptr_t) j);
+		ch_test_assert_cmpint(rc, ==, 0);
+	}
+	mti_23k640_dma_to_cpu(0x0100, tmp, sizeof(tmp));
+	mti_23k640_dma_wait();
+	ch_test_assert_cmpint(_done_count, ==, 2);
+	ch_test_assert(memcmp(tmp, buf[1], sizeof(tmp)) == 0);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/* moves through a bounce buffer and checks against memmove() */
+static void
+ch_test_sram_move_check(uint16_t dest, uint16_t src, uint16_t length,
+			uint16_t buflen, uint16_t transfers)
+{
+	static uint8_t expected[CH_MOCK_SRAM_SIZE];
+	uint8_t buf[256];
+	uint16_t i;
+
+	ch_test_sram_setup();
+	for (i = 0; i < CH_MOCK_SRAM_SIZE; i++)
+		ch_mock.sram[i] = i ^ (i >> 8) * 7;
+	memcpy(expected, ch_mock.sram, sizeof(expected));
+	memmove(&expected[dest], &expected[src], length);
+	mti_23k640_move(dest, src, length, buf, buflen);
+	ch_test_assert(memcmp(ch_mock.sram, expected, sizeof(expected)) == 0);
+	ch_test_assert_cmpint(ch_mock.dma_transfers, ==, transfers);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/*
+ * Overlapping areas are copied like memmove() whichever way they overlap,
+ * one chunk at a time with a short chunk for the remainder.
+ */
+static void
+ch_test_sram_move(void)
+{
+	/* the destination is before the source */
+	ch_test_sram_move_check(0x0100, 0x0140, 0x0200, 256, 2 * 2);
+
+	/* the destination is after the source, so it copies from the end */
+	ch_test_sram_move_check(0x0140, 0x0100, 0x0200, 256, 2 * 2);
+
+	/* less than one chunk apart, with a short last chunk */
+	ch_test_sram_move_check(0x1000, 0x1003, 1000, 256, 4 * 2);
+	ch_test_sram_move_check(0x1003, 0x1000, 1000, 256, 4 * 2);
+	ch_test_sram_move_check(0x0201, 0x0200, 1, 256, 1 * 2);
+
+	/* not overlapping at all */
+	ch_test_sram_move_check(0x0000, 0x1000, 0x0301, 64, 13 * 2);
+
+	/* the same place is nothing to do */
+	ch_test_sram_move_check(0x0800, 0x0800, 0x0400, 256, 0);
+}
+
+/* one byte is sent for every transfer of up to 1024 bytes */
+static void
+ch_test_sram_fill(void)
+{
+	uint16_t i;
+
+	ch_test_sram_setup();
+	memset(ch_mock.sram, 0x00, sizeof(ch_mock.sram));
+	mti_23k640_fill(0x0123, 0x5a, 2500);
+	for (i = 0; i < CH_MOCK_SRAM_SIZE; i++) {
+		if (i >= 0x0123 && i < 0x0123 + 2500)
+			ch_test_assert_cmpint(ch_mock.sram[i], ==, 0x5a);
+		else
+			ch_test_assert_cmpint(ch_mock.sram[i], ==, 0x00);
+	}
+	ch_test_assert_cmpint(ch_mock.dma_transfers, ==, 3);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+
+	/* later transfers increment the CPU address again */
+	ch_test_assert_cmpint(DMACON1bits.TXINC, ==, 1);
+}
+
+/* the shared regions overlap, so only one of them can be claimed at once */
+static void
+ch_test_sram_regions(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < CH_SRAM_REGION_LAST; i++)
+		ch_test_assert(!chug_sram_is_live(i));
+
+	/* averaging a whole frame uses all of the top half */
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_ACCUMULATOR, 0x1000),
+			      ==, CH_ERROR_NONE);
+	ch_test_assert(chug_sram_is_live(CH_SRAM_REGION_ACCUMULATOR));
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_RESAMPLE_INDEX, 2),
+			      ==, CH_ERROR_OUT_OF_MEMORY);
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_RESAMPLED, 0x0400),
+			      ==, CH_ERROR_OUT_OF_MEMORY);
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_SPECTRUM_ALT, 0x0800),
+			      ==, CH_ERROR_OUT_OF_MEMORY);
+	ch_test_assert(!chug_sram_is_live(CH_SRAM_REGION_RESAMPLED));
+
+	/* the bottom half does not overlap */
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_SPECTRUM, 0x0800),
+			      ==, CH_ERROR_NONE);
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_DARK, 0x0800),
+			      ==, CH_ERROR_NONE);
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_DARK, 0x0801),
+			      ==, CH_ERROR_INVALID_LENGTH);
+
+	/* a smaller window leaves the end of the region free */
+	chug_sram_release(CH_SRAM_REGION_ACCUMULATOR);
+	ch_test_assert(!chug_sram_is_live(CH_SRAM_REGION_ACCUMULATOR));
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_ACCUMULATOR, 0x0800),
+			      ==, CH_ERROR_NONE);
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_RESAMPLE_INDEX, 0x0400),
+			      ==, CH_ERROR_NONE);
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_RESAMPLED, 0x0400),
+			      ==, CH_ERROR_NONE);
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_SPECTRUM_ALT, 2),
+			      ==, CH_ERROR_OUT_OF_MEMORY);
+
+	/* a resampled spectrum in use cannot be overwritten by averaging */
+	chug_sram_release(CH_SRAM_REGION_ACCUMULATOR);
+	chug_sram_release(CH_SRAM_REGION_RESAMPLE_INDEX);
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_ACCUMULATOR, 0x1000),
+			      ==, CH_ERROR_OUT_OF_MEMORY);
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_ACCUMULATOR, 0x0c00),
+			      ==, CH_ERROR_NONE);
+
+	/* claiming again just changes the length */
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_ACCUMULATOR, 0x0400),
+			      ==, CH_ERROR_NONE);
+	ch_test_assert_cmpint(chug_sram_claim(CH_SRAM_REGION_RESAMPLE_INDEX, 0x0400),
+			      ==, CH_ERROR_NONE);
+
+	for (i = 0; i < CH_SRAM_REGION_LAST; i++)
+		chug_sram_release(i);
+}
+
+int
+main(void)
+{
+	ch_test_run(ch_test_sram_queue);
+	ch_test_run(ch_test_sram_chain);
+	ch_test_run(ch_test_sram_blocking);
+	ch_test_run(ch_test_sram_move);
+	ch_test_run(ch_test_sram_fill);
+	ch_test_run(ch_test_sram_regions);
+	return 0;
+}
@@ -0,0 +1,183 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "ch-mock.h"
+#include "ch-test.h"
+#include "ch-timer.h"
+
+/*
+ * The timers are built for whichever clock variant HAVE_24MHZ selects, and
+ * the mock runs the instruction clock to match, so the same checks cover
+ * both prescaler settings.
+ */
+
+/* when the timers were started, which is a few instructions later than
+ * Timer0 really was */
+static uint64_t _start;
+
+static void
+ch_test_timer_setup(void)
+{
+	ch_mock_reset();
+	chug_timer_init();
+	_start = ch_mock.now;
+}
+
+/* the ms and us counters stay exact when polled at least every 1.39s */
+static void
+ch_test_timer_ms(void)
+{
+	uint64_t elapsed;
+	uint32_t ms;
+	uint32_t us;
+	uint16_t i;
+
+	ch_test_timer_setup();
+	for (i = 0; i < 1000; i++) {
+		ch_mock_advance(1000000ULL * (1 + (i * 337) % 1300) + i * 777);
+		ms = chug_timer_get_ms();
+		us = chug_timer_get_us();
+		elapsed = ch_mock.now - _start;
+		ch_test_assert_cmpint(ms, <=, elapsed / 1000000);
+		ch_test_assert_cmpint(ms, >=, elapsed / 1000000 - 1);
+		ch_test_assert_cmpint(us, <=, elapsed / 1000 + 5);
+		ch_test_assert_cmpint(us, >, elapsed / 1000 - 22);
+	}
+
+	/* over ten minutes, so there is no drift */
+	ch_test_assert_cmpint(ms, >, 600000);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/*
+ * One wrap of Timer0 between calls is counted from the overflow flag, so
+ * the ms counter stays exact for up to 2.79s when the counter only wraps
+ * once in that time.
+ */
+static void
+ch_test_timer_wrap(void)
+{
+	uint64_t elapsed;
+	uint64_t ticks;
+	uint32_t ms;
+	uint16_t now;
+	uint16_t i;
+
+	ch_test_timer_setup();
+	for (i = 0; i < 100; i++) {
+		chug_timer_get_ms();
+		now = TMR0L;
+		now |= ((uint16_t) TMR0H) << 8;
+
+		/* a whole cycle, then up to a little before the next wrap */
+		ticks = 0x10000 + (uint64_t) (0xfff0 - now) * (i % 50) / 50;
+		ch_mock_advance(ticks * 64000 / 3);
+		ms = chug_timer_get_ms();
+		elapsed = ch_mock.now - _start;
+		ch_test_assert_cmpint(ms, <=, elapsed / 1000000);
+		ch_test_assert_cmpint(ms, >=, elapsed / 1000000 - 1);
+
+		/* and then an ordinary step */
+		ch_mock_advance(1000000ULL * (1 + (i * 337) % 1300));
+	}
+	ch_test_assert_cmpint(ms, >, 100 * 1390);
+	ch_test_assert_cmpint(ch_mock.errors, ==, 0);
+}
+
+/* Timer1 runs at 3MHz and wraps every 21.8ms */
+static void
+ch_test_timer_ticks(void)
+{
+	uint64_t expected;
+	uint16_t ticks;
+	uint16_t i;
+
+	ch_test_timer_setup();
+	for (i = 0; i < 1000; i++) {
+		ch_mock_advance(1000 + i * 7919);
+		ticks = chug_timer_get_ticks();
+		expected = (ch_mock.now - _start) * CH_TIMER_TICKS_PER_US / 1000;
+		ch_test_assert_cmpint((uint16_t) (expected - ticks), <=, 1);
+	}
+}
+
+/* a deadline is passed within a tick of when it falls, even across the wrap */
+static void
+ch_test_timer_deadline(void)
+{
+	uint16_t deadline;
+	uint16_t i;
+
+	ch_test_timer_setup();
+	for (i = 0; i < 100; i++) {
+		ch_mock_advance(100000 + i * 3331);
+		deadline = chug_timer_get_deadline(10000);
+		ch_test_assert(!chug_timer_deadline_passed(deadline));
+		ch_mock_advance(10000000 - 2000);
+		ch_test_assert(!chug_timer_deadline_passed(deadline));
+		ch_mock_advance(3000);
+		ch_test_assert(chug_timer_deadline_passed(deadline));
+
+		/* and stays passed for a while */
+		ch_mock_advance(9000000);
+		ch_test_assert(chug_timer_deadline_passed(deadline));
+	}
+}
+
+/*
+ * Waits are only long by the cost of the call. They can start part way
+ * through a tick, which the call overhead covers on the device, but the
+ * mock only charges for register accesses, so allow one tick short.
+ */
+static void
+ch_test_timer_wait_us(void)
+{
+	const uint16_t waits[] = { 1, 2, 10, 100, 1000, 9999, 10000,
+				   10001, 25000, 65535 };
+	uint64_t before;
+	uint64_t elapsed;
+	uint8_t i;
+	uint8_t j;
+
+	ch_test_timer_setup();
+	for (i = 0; i < sizeof(waits) / sizeof(waits[0]); i++) {
+		for (j = 0; j < 10; j++) {
+			ch_mock_advance(j * 113);
+			before = ch_mock.now;
+			chug_timer_wait_us(waits[i]);
+			elapsed = ch_mock.now - before;
+			ch_test_assert_cmpint(elapsed, >=, waits[i] * 1000ULL -
+					      1000 / CH_TIMER_TICKS_PER_US);
+			ch_test_assert_cmpint(elapsed, <, waits[i] * 1000ULL + 5000);
+		}
+	}
+}
+
+int
+main(void)
+{
+	ch_test_run(ch_test_timer_ms);
+	ch_test_run(ch_test_timer_wrap);
+	ch_test_run(ch_test_timer_ticks);
+	ch_test_run(ch_test_timer_deadline);
+	ch_test_run(ch_test_timer_wait_us);
+	return 0;
+}
@@ -0,0 +1,57 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* stands in for the compiler header when building the tests on the host */
+
+#ifndef __CH_MOCK_XC_H
+#define __CH_MOCK_XC_H
+
+#include <stddef.h>
+
+#include "ch-mock.h"
+
+#ifndef TRUE
+#define TRUE				1
+#endif
+#ifndef FALSE
+#define FALSE				0
+#endif
+
+#define ClrWdt()			ch_mock_sync()
+#define CLRWDT()			ch_mock_sync()
+
+#define ADCON0bits			(*ch_mock_adcon0())
+#define ADCON1bits			(*ch_mock_adcon1())
+#define ADRES				(ch_mock_adres())
+#define DMACON1bits			(*ch_mock_dmacon1())
+#define INTCONbits			(*ch_mock_intcon())
+#define T0CONbits			(*ch_mock_t0con())
+#define T1CONbits			(*ch_mock_t1con())
+#define TMR0L				(*ch_mock_tmr0l())
+#define TMR0H				(*ch_mock_tmr0h())
+#define TMR1L				(*ch_mock_tmr1l())
+#define TMR1H				(*ch_mock_tmr1h())
+#define PORTAbits			(*ch_mock_porta())
+#define PORTCbits			(*ch_mock_portc())
+#define PORTDbits			(*ch_mock_portd())
+#define PORTEbits			(*ch_mock_porte())
+
+#endif /* __CH_MOCK_XC_H */